@@ -1,5 +1,159 @@
 #include "mpc.h"
 
+/*
+** Arena
+**
+** All of mpc allocates through `mpc_malloc` and friends, which go to the
+** current arena if there is one. Each allocation has its size in front
+** of it for `mpc_realloc`, and the most recent one grows in place, which
+** covers strings and child arrays being built up.
+*/
+
+#define MPC_ARENA_CHUNK 16384
+
+typedef union {
+  size_t size;
+  void *p;
+  double d;
+} mpc_arena_head_t;
+
+typedef struct mpc_chunk_t {
+  struct mpc_chunk_t *next;
+  size_t size;
+  size_t used;
+} mpc_chunk_t;
+
+struct mpc_arena_t {
+  mpc_chunk_t *first;
+  mpc_chunk_t *chunk;
+  void *last;
+  long allocs;
+  long bytes;
+};
+
+static mpc_arena_t *mpc_arena_current = NULL;
+
+static size_t mpc_arena_round(size_t n) {
+  return sizeof(mpc_arena_head_t) + (n + sizeof(mpc_arena_head_t) - 1) / sizeof(mpc_arena_head_t) * sizeof(mpc_arena_head_t);
+}
+
+static mpc_chunk_t *mpc_chunk_new(size_t size, mpc_chunk_t *next) {
+  mpc_chunk_t *c = malloc(sizeof(mpc_chunk_t) + size);
+  c->next = next;
+  c->size = size;
+  c->used = 0;
+  return c;
+}
+
+static void *mpc_arena_alloc(mpc_arena_t *a, size_t n) {
+  
+  mpc_chunk_t *c = a->chunk;
+  mpc_arena_head_t *h;
+  size_t need = mpc_arena_round(n);
+  
+  /* Chunks past the current one are left over from before the last end */
+  while (c->used + need > c->size) {
+    if (c->next == NULL || c->next->size < need) {
+      c->next = mpc_chunk_new(need > MPC_ARENA_CHUNK ? need : MPC_ARENA_CHUNK, c->next);
+    }
+    c = c->next;
+    c->used = 0;
+  }
+  
+  h = (mpc_arena_head_t*)((char*)(c + 1) + c->used);
+  h->size = n;
+  c->used += need;
+  a->chunk = c;
+  a->last = h + 1;
+  a->allocs++;
+  a->bytes += n;
+  return h + 1;
+  
+}
+
+static void *mpc_arena_realloc(mpc_arena_t *a, void *p, size_t n) {
+  
+  mpc_arena_head_t *h;
+  mpc_chunk_t *c = a->chunk;
+  void *q;
+  
+  if (p == NULL) { return mpc_arena_alloc(a, n); }
+  
+  h = (mpc_arena_head_t*)p - 1;
+  
+  if (p == a->last && c->used - mpc_arena_round(h->size) + mpc_arena_round(n) <= c->size) {
+    c->used = c->used - mpc_arena_round(h->size) + mpc_arena_round(n);
+    a->allocs++;
+    a->bytes += (long)n - (long)h->size;
+    h->size = n;
+    return p;
+  }
+  
+  if (n <= h->size) { return p; }
+  
+  q = mpc_arena_alloc(a, n);
+  memcpy(q, p, h->size);
+  return q;
+  
+}
+
+static void *mpc_malloc(size_t n) {
+  if (mpc_arena_current) { return mpc_arena_alloc(mpc_arena_current, n); }
+  return malloc(n);
+}
+
+static void *mpc_calloc(size_t n, size_t m) {
+  void *p;
+  if (mpc_arena_current == NULL) { return calloc(n, m); }
+  p = mpc_arena_alloc(mpc_arena_current, n * m);
+  memset(p, 0, n * m);
+  return p;
+}
+
+static void *mpc_realloc(void *p, size_t n) {
+  if (mpc_arena_current) { return mpc_arena_realloc(mpc_arena_current, p, n); }
+  return realloc(p, n);
+}
+
+static void mpc_free(void *p) {
+  if (mpc_arena_current == NULL) { free(p); }
+}
+
+mpc_arena_t *mpc_arena_new(void) {
+  mpc_arena_t *a = malloc(sizeof(mpc_arena_t));
+  a->first = mpc_chunk_new(MPC_ARENA_CHUNK, NULL);
+  a->chunk = a->first;
+  a->last = NULL;
+  a->allocs = 0;
+  a->bytes = 0;
+  return a;
+}
+
+void mpc_arena_delete(mpc_arena_t *a) {
+  mpc_chunk_t *c, *n;
+  for (c = a->first; c != NULL; c = n) {
+    n = c->next;
+    free(c);
+  }
+  free(a);
+}
+
+void mpc_arena_begin(mpc_arena_t *a) {
+  a->allocs = 0;
+  a->bytes = 0;
+  mpc_arena_current = a;
+}
+
+void mpc_arena_end(mpc_arena_t *a) {
+  a->chunk = a->first;
+  a->chunk->used = 0;
+  a->last = NULL;
+  mpc_arena_current = NULL;
+}
+
+long mpc_arena_allocs(mpc_arena_t *a) { return a->allocs; }
+long mpc_arena_bytes(mpc_arena_t *a) { return a->bytes; }
+
 /*
 ** State Type
 */
@@ -21,7 +175,7 @@ static mpc_state_t mpc_state_new(void) {
 }
 
 static mpc_state_t *mpc_state_copy(mpc_state_t s) {
-  mpc_state_t *r = malloc(sizeof(mpc_state_t));
+  mpc_state_t *r = mpc_malloc(sizeof(mpc_state_t));
   memcpy(r, &s, sizeof(mpc_state_t));
   return r;
 }
@@ -31,13 +185,13 @@ static mpc_state_t *mpc_state_copy(mpc_state_t s) {
 */
 
 static mpc_err_t *mpc_err_new(const char *filename, mpc_state_t s, const char *expected, char recieved) {
-  mpc_err_t *x = malloc(sizeof(mpc_err_t));
-  x->filename = malloc(strlen(filename) + 1);
+  mpc_err_t *x = mpc_malloc(sizeof(mpc_err_t));
+  x->filename = mpc_malloc(strlen(filename) + 1);
   strcpy(x->filename, filename);
   x->state = s;
   x->expected_num = 1;
-  x->expected = malloc(sizeof(char*));
-  x->expected[0] = malloc(strlen(expected) + 1);
+  x->expected = mpc_malloc(sizeof(char*));
+  x->expected[0] = mpc_malloc(strlen(expected) + 1);
   strcpy(x->expected[0], expected);
   x->failure = NULL;
   x->recieved = recieved;
@@ -45,13 +199,13 @@ static mpc_err_t *mpc_err_new(const char *filename, mpc_state_t s, const char *e
 }
 
 static mpc_err_t *mpc_err_fail(const char *filename, mpc_state_t s, const char *failure) {
-  mpc_err_t *x = malloc(sizeof(mpc_err_t));
-  x->filename = malloc(strlen(filename) + 1);
+  mpc_err_t *x = mpc_malloc(sizeof(mpc_err_t));
+  x->filename = mpc_malloc(strlen(filename) + 1);
   strcpy(x->filename, filename);
   x->state = s;
   x->expected_num = 0;
   x->expected = NULL;
-  x->failure = malloc(strlen(failure) + 1);
+  x->failure = mpc_malloc(strlen(failure) + 1);
   strcpy(x->failure, failure);
   x->recieved = ' ';
   return x;
@@ -61,13 +215,13 @@ void mpc_err_delete(mpc_err_t *x) {
 
   int i;
   for (i = 0; i < x->expected_num; i++) {
-    free(x->expected[i]);
+    mpc_free(x->expected[i]);
   }
   
-  free(x->expected);
-  free(x->filename);
-  free(x->failure);
-  free(x);
+  mpc_free(x->expected);
+  mpc_free(x->filename);
+  mpc_free(x->failure);
+  mpc_free(x);
 }
 
 static int mpc_err_contains_expected(mpc_err_t *x, char *expected) {
@@ -83,8 +237,8 @@ static int mpc_err_contains_expected(mpc_err_t *x, char *expected) {
 static void mpc_err_add_expected(mpc_err_t *x, char *expected) {
   
   x->expected_num++;
-  x->expected = realloc(x->expected, sizeof(char*) * x->expected_num);
-  x->expected[x->expected_num-1] = malloc(strlen(expected) + 1);
+  x->expected = mpc_realloc(x->expected, sizeof(char*) * x->expected_num);
+  x->expected[x->expected_num-1] = mpc_malloc(strlen(expected) + 1);
   strcpy(x->expected[x->expected_num-1], expected);
   
 }
@@ -93,11 +247,11 @@ static void mpc_err_clear_expected(mpc_err_t *x, char *expected) {
   
   int i;
   for (i = 0; i < x->expected_num; i++) {
-    free(x->expected[i]);
+    mpc_free(x->expected[i]);
   }
   x->expected_num = 1;
-  x->expected = realloc(x->expected, sizeof(char*) * x->expected_num);
-  x->expected[0] = malloc(strlen(expected) + 1);
+  x->expected = mpc_realloc(x->expected, sizeof(char*) * x->expected_num);
+  x->expected[0] = mpc_malloc(strlen(expected) + 1);
   strcpy(x->expected[0], expected);
   
 }
@@ -109,7 +263,7 @@ void mpc_err_print(mpc_err_t *x) {
 void mpc_err_print_to(mpc_err_t *x, FILE *f) {
   char *str = mpc_err_string(x);
   fprintf(f, "%s", str);
-  free(str);
+  mpc_free(str);
 }
 
 void mpc_err_string_cat(char *buffer, int *pos, int *max, char const *fmt, ...) {
@@ -154,7 +308,7 @@ char *mpc_err_string(mpc_err_t *x) {
   int i;  
   int pos = 0; 
   int max = 1023;
-  char *buffer = calloc(1, 1024);
+  char *buffer = mpc_calloc(1, 1024);
   
   if (x->failure) {
     mpc_err_string_cat(buffer, &pos, &max,
@@ -179,21 +333,21 @@ char *mpc_err_string(mpc_err_t *x) {
   }
   
   mpc_err_string_cat(buffer, &pos, &max, " at ");
-  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->recieved));
+  mpc_err_string_cat(buffer, &pos, &max, "%s", mpc_err_char_unescape(x->recieved));
   mpc_err_string_cat(buffer, &pos, &max, "\n");
   
-  return realloc(buffer, strlen(buffer) + 1);
+  return mpc_realloc(buffer, strlen(buffer) + 1);
 }
 
 static mpc_err_t *mpc_err_or(mpc_err_t** x, int n) {
   
   int i, j;
-  mpc_err_t *e = malloc(sizeof(mpc_err_t));
+  mpc_err_t *e = mpc_malloc(sizeof(mpc_err_t));
   e->state = mpc_state_invalid();
   e->expected_num = 0;
   e->expected = NULL;
   e->failure = NULL;
-  e->filename = malloc(strlen(x[0]->filename)+1);
+  e->filename = mpc_malloc(strlen(x[0]->filename)+1);
   strcpy(e->filename, x[0]->filename);
   
   for (i = 0; i < n; i++) {
@@ -205,7 +359,7 @@ static mpc_err_t *mpc_err_or(mpc_err_t** x, int n) {
     if (x[i]->state.pos < e->state.pos) { continue; }
     
     if (x[i]->failure) {
-      e->failure = malloc(strlen(x[i]->failure)+1);
+      e->failure = mpc_malloc(strlen(x[i]->failure)+1);
       strcpy(e->failure, x[i]->failure);
       break;
     }
@@ -227,32 +381,32 @@ static mpc_err_t *mpc_err_or(mpc_err_t** x, int n) {
 static mpc_err_t *mpc_err_repeat(mpc_err_t *x, const char *prefix) {
 
   int i;
-  char *expect = malloc(strlen(prefix) + 1);
+  char *expect = mpc_malloc(strlen(prefix) + 1);
   strcpy(expect, prefix);
   
   if (x->expected_num == 1) {
-    expect = realloc(expect, strlen(expect) + strlen(x->expected[0]) + 1);
+    expect = mpc_realloc(expect, strlen(expect) + strlen(x->expected[0]) + 1);
     strcat(expect, x->expected[0]);
   }
   
   if (x->expected_num > 1) {
   
     for (i = 0; i < x->expected_num-2; i++) {
-      expect = realloc(expect, strlen(expect) + strlen(x->expected[i]) + strlen(", ") + 1);
+      expect = mpc_realloc(expect, strlen(expect) + strlen(x->expected[i]) + strlen(", ") + 1);
       strcat(expect, x->expected[i]);
       strcat(expect, ", ");
     }
     
-    expect = realloc(expect, strlen(expect) + strlen(x->expected[x->expected_num-2]) + strlen(" or ") + 1);
+    expect = mpc_realloc(expect, strlen(expect) + strlen(x->expected[x->expected_num-2]) + strlen(" or ") + 1);
     strcat(expect, x->expected[x->expected_num-2]);
     strcat(expect, " or ");
-    expect = realloc(expect, strlen(expect) + strlen(x->expected[x->expected_num-1]) + 1);
+    expect = mpc_realloc(expect, strlen(expect) + strlen(x->expected[x->expected_num-1]) + 1);
     strcat(expect, x->expected[x->expected_num-1]);
 
   }
   
   mpc_err_clear_expected(x, expect);
-  free(expect);
+  mpc_free(expect);
   
   return x;
 
@@ -265,10 +419,10 @@ static mpc_err_t *mpc_err_many1(mpc_err_t *x) {
 static mpc_err_t *mpc_err_count(mpc_err_t *x, int n) {
   mpc_err_t *y;
   int digits = n/10 + 1;
-  char *prefix = malloc(digits + strlen(" of ") + 1);
+  char *prefix = mpc_malloc(digits + strlen(" of ") + 1);
   sprintf(prefix, "%i of ", n);
   y = mpc_err_repeat(x, prefix);
-  free(prefix);
+  mpc_free(prefix);
   return y;
 }
 
@@ -320,8 +474,13 @@ typedef struct {
   mpc_state_t state;
   
   char *string;
+  long length;
   char *buffer;
   FILE *file;
+  const char *slices;
+  
+  int rerun;
+  int dfa_used;
   
   int backtrack;
   int marks_num;
@@ -334,18 +493,23 @@ typedef struct {
 
 static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
 
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  mpc_input_t *i = mpc_malloc(sizeof(mpc_input_t));
   
-  i->filename = malloc(strlen(filename) + 1);
+  i->filename = mpc_malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
   i->type = MPC_INPUT_STRING;
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
+  i->length = strlen(string);
+  i->string = mpc_malloc(i->length + 1);
   strcpy(i->string, string);
   i->buffer = NULL;
   i->file = NULL;
+  i->slices = NULL;
+  
+  i->rerun = 0;
+  i->dfa_used = 0;
   
   i->backtrack = 1;
   i->marks_num = 0;
@@ -359,17 +523,22 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
 
 static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
 
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  mpc_input_t *i = mpc_malloc(sizeof(mpc_input_t));
   
-  i->filename = malloc(strlen(filename) + 1);
+  i->filename = mpc_malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
   
   i->type = MPC_INPUT_PIPE;
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = pipe;
+  i->slices = NULL;
+  
+  i->rerun = 0;
+  i->dfa_used = 0;
   
   i->backtrack = 1;
   i->marks_num = 0;
@@ -384,16 +553,21 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
 
 static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  mpc_input_t *i = mpc_malloc(sizeof(mpc_input_t));
   
-  i->filename = malloc(strlen(filename) + 1);
+  i->filename = mpc_malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
   i->type = MPC_INPUT_FILE;
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = file;
+  i->slices = NULL;
+  
+  i->rerun = 0;
+  i->dfa_used = 0;
   
   i->backtrack = 1;
   i->marks_num = 0;
@@ -407,14 +581,14 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
 
 static void mpc_input_delete(mpc_input_t *i) {
   
-  free(i->filename);
+  mpc_free(i->filename);
   
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
-  if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+  if (i->type == MPC_INPUT_STRING) { mpc_free(i->string); }
+  if (i->type == MPC_INPUT_PIPE) { mpc_free(i->buffer); }
   
-  free(i->marks);
-  free(i->lasts);
-  free(i);
+  mpc_free(i->marks);
+  mpc_free(i->lasts);
+  mpc_free(i);
 }
 
 static void mpc_input_backtrack_disable(mpc_input_t *i) { i->backtrack--; }
@@ -425,13 +599,13 @@ static void mpc_input_mark(mpc_input_t *i) {
   if (i->backtrack < 1) { return; }
   
   i->marks_num++;
-  i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_num);
-  i->lasts = realloc(i->lasts, sizeof(char) * i->marks_num);
+  i->marks = mpc_realloc(i->marks, sizeof(mpc_state_t) * i->marks_num);
+  i->lasts = mpc_realloc(i->lasts, sizeof(char) * i->marks_num);
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
   
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
+    i->buffer = mpc_calloc(1, 1);
   }
   
 }
@@ -441,11 +615,11 @@ static void mpc_input_unmark(mpc_input_t *i) {
   if (i->backtrack < 1) { return; }
   
   i->marks_num--;
-  i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_num);
-  i->lasts = realloc(i->lasts, sizeof(char) * i->marks_num);
+  i->marks = mpc_realloc(i->marks, sizeof(mpc_state_t) * i->marks_num);
+  i->lasts = mpc_realloc(i->lasts, sizeof(char) * i->marks_num);
   
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    free(i->buffer);
+    mpc_free(i->buffer);
     i->buffer = NULL;
   }
   
@@ -474,7 +648,7 @@ static char mpc_input_buffer_get(mpc_input_t *i) {
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos == i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
   if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
   return 0;
@@ -567,7 +741,7 @@ static int mpc_input_success(mpc_input_t *i, char c, char **o) {
       i->buffer &&
       !mpc_input_buffer_in_range(i)) {
     
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
+    i->buffer = mpc_realloc(i->buffer, strlen(i->buffer) + 2);
     i->buffer[strlen(i->buffer) + 1] = '\0';
     i->buffer[strlen(i->buffer) + 0] = c;
   }
@@ -582,7 +756,7 @@ static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   }
   
   if (o) {
-    (*o) = malloc(2);
+    (*o) = mpc_malloc(2);
     (*o)[0] = c;
     (*o)[1] = '\0';
   }
@@ -634,7 +808,7 @@ static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   mpc_input_mark(i);
   while (*x) {
     if (mpc_input_char(i, *x, &co)) {
-      free(co);
+      mpc_free(co);
     } else {
       mpc_input_rewind(i);
       return 0;
@@ -643,11 +817,38 @@ static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   }
   mpc_input_unmark(i);
   
-  *o = malloc(strlen(c) + 1);
+  *o = mpc_malloc(strlen(c) + 1);
   strcpy(*o, c);
   return 1;
 }
 
+/* Skips n characters of string input at once */
+static void mpc_input_skip(mpc_input_t *i, long n) {
+  
+  long k;
+  const char *o = i->string + i->state.pos;
+  
+  for (k = 0; k < n; k++) {
+    i->state.pos++;
+    i->state.col++;
+    if (o[k] == '\n') {
+      i->state.col = 0;
+      i->state.row++;
+    }
+  }
+  
+  if (n > 0) { i->last = o[n-1]; }
+}
+
+/* Consumes n characters of string input at once */
+static char *mpc_input_take(mpc_input_t *i, long n) {
+  char *o = mpc_malloc(n + 1);
+  memcpy(o, i->string + i->state.pos, n);
+  o[n] = '\0';
+  mpc_input_skip(i, n);
+  return o;
+}
+
 static int mpc_input_anchor(mpc_input_t* i, int(*f)(char,char)) {
   return f(i->last, mpc_input_peekc(i));
 }
@@ -684,7 +885,10 @@ enum {
   MPC_TYPE_COUNT     = 22,
   
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+  
+  MPC_TYPE_REGEX     = 25,
+  MPC_TYPE_LEAF      = 26
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -702,6 +906,8 @@ typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
 typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { struct mpc_regex_t *x; } mpc_pdata_regex_t;
+typedef struct { mpc_parser_t *x; } mpc_pdata_leaf_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -719,6 +925,8 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_regex_t regex;
+  mpc_pdata_leaf_t leaf;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -728,6 +936,47 @@ struct mpc_parser_t {
   mpc_pdata_t data;
 };
 
+/*
+** Regex Type
+**
+** Every `mpc_re` parser points at a shared entry for its regex string,
+** holding the parser the regex was built into and, where it could be
+** compiled, a DFA for it. Bytes map to classes of bytes the regex does
+** not tell apart, and a transition of -1 is a dead end.
+*/
+
+typedef struct {
+  int classes_num;
+  int states_num;
+  unsigned char classes[256];
+  int *trans;
+  char *accept;
+} mpc_dfa_t;
+
+typedef struct mpc_regex_t {
+  char *re;
+  int refs;
+  int shared;
+  mpc_parser_t *x;
+  mpc_dfa_t *dfa;
+  struct mpc_regex_t *next;
+} mpc_regex_t;
+
+static void mpc_regex_release(mpc_regex_t *x);
+
+/* Longest match at the start of s, or -1 */
+static long mpc_dfa_match(const mpc_dfa_t *d, const char *s) {
+  
+  int q = 0;
+  long k, n = d->accept[0] ? 0 : -1;
+  
+  for (k = 0; (q = d->trans[q * d->classes_num + d->classes[(unsigned char)s[k]]]) >= 0; k++) {
+    if (d->accept[q]) { n = k + 1; }
+  }
+  
+  return n;
+}
+
 /*
 ** Stack Type
 */
@@ -749,7 +998,7 @@ typedef struct {
 } mpc_stack_t;
 
 static mpc_stack_t *mpc_stack_new(const char *filename) {
-  mpc_stack_t *s = malloc(sizeof(mpc_stack_t));
+  mpc_stack_t *s = mpc_malloc(sizeof(mpc_stack_t));
   
   s->parsers_num = 0;
   s->parsers_slots = 0;
@@ -784,11 +1033,11 @@ static int mpc_stack_terminate(mpc_stack_t *s, mpc_result_t *r) {
     r->error = s->err;
   }
   
-  free(s->parsers);
-  free(s->states);
-  free(s->results);
-  free(s->returns);
-  free(s);
+  mpc_free(s->parsers);
+  mpc_free(s->states);
+  mpc_free(s->results);
+  mpc_free(s->returns);
+  mpc_free(s);
   
   return success;
 }
@@ -802,16 +1051,16 @@ static void mpc_stack_set_state(mpc_stack_t *s, int x) {
 static void mpc_stack_parsers_reserve_more(mpc_stack_t *s) {
   if (s->parsers_num > s->parsers_slots) {
     s->parsers_slots = ceil((s->parsers_slots+1) * 1.5);
-    s->parsers = realloc(s->parsers, sizeof(mpc_parser_t*) * s->parsers_slots);
-    s->states = realloc(s->states, sizeof(int) * s->parsers_slots);
+    s->parsers = mpc_realloc(s->parsers, sizeof(mpc_parser_t*) * s->parsers_slots);
+    s->states = mpc_realloc(s->states, sizeof(int) * s->parsers_slots);
   }
 }
 
 static void mpc_stack_parsers_reserve_less(mpc_stack_t *s) {
   if (s->parsers_slots > pow(s->parsers_num+1, 1.5)) {
     s->parsers_slots = floor((s->parsers_slots-1) * (1.0/1.5));
-    s->parsers = realloc(s->parsers, sizeof(mpc_parser_t*) * s->parsers_slots);
-    s->states = realloc(s->states, sizeof(int) * s->parsers_slots);
+    s->parsers = mpc_realloc(s->parsers, sizeof(mpc_parser_t*) * s->parsers_slots);
+    s->states = mpc_realloc(s->states, sizeof(int) * s->parsers_slots);
   }
 }
 
@@ -855,16 +1104,16 @@ static mpc_result_t mpc_result_out(mpc_val_t *x) {
 static void mpc_stack_results_reserve_more(mpc_stack_t *s) {
   if (s->results_num > s->results_slots) {
     s->results_slots = ceil((s->results_slots + 1) * 1.5);
-    s->results = realloc(s->results, sizeof(mpc_result_t) * s->results_slots);
-    s->returns = realloc(s->returns, sizeof(int) * s->results_slots);
+    s->results = mpc_realloc(s->results, sizeof(mpc_result_t) * s->results_slots);
+    s->returns = mpc_realloc(s->returns, sizeof(int) * s->results_slots);
   }
 }
 
 static void mpc_stack_results_reserve_less(mpc_stack_t *s) {
   if ( s->results_slots > pow(s->results_num+1, 1.5)) {
     s->results_slots = floor((s->results_slots-1) * (1.0/1.5));
-    s->results = realloc(s->results, sizeof(mpc_result_t) * s->results_slots);
-    s->returns = realloc(s->returns, sizeof(int) * s->results_slots);
+    s->results = mpc_realloc(s->results, sizeof(mpc_result_t) * s->results_slots);
+    s->returns = mpc_realloc(s->returns, sizeof(int) * s->results_slots);
   }
 }
 
@@ -898,11 +1147,12 @@ static void mpc_stack_popr_err(mpc_stack_t *s, int n) {
   }
 }
 
+/* The destructors may be NULL, when there is nothing to free */
 static void mpc_stack_popr_out(mpc_stack_t *s, int n, mpc_dtor_t *ds) {
   mpc_result_t x;
   while (n) {
     mpc_stack_popr(s, &x);
-    ds[n-1](x.output);
+    if (ds) { ds[n-1](x.output); }
     n--;
   }
 }
@@ -911,7 +1161,7 @@ static void mpc_stack_popr_out_single(mpc_stack_t *s, int n, mpc_dtor_t dx) {
   mpc_result_t x;
   while (n) {
     mpc_stack_popr(s, &x);
-    dx(x.output);
+    if (dx) { dx(x.output); }
     n--;
   }
 }
@@ -925,7 +1175,7 @@ static void mpc_stack_popr_n(mpc_stack_t *s, int n) {
 }
 
 static mpc_val_t *mpc_stack_merger_out(mpc_stack_t *s, int n, mpc_fold_t f) {
-  mpc_val_t *x = f(n, (mpc_val_t**)(&s->results[s->results_num-n]));
+  mpc_val_t *x = f ? f(n, (mpc_val_t**)(&s->results[s->results_num-n])) : NULL;
   mpc_stack_popr_n(s, n);
   return x;
 }
@@ -960,9 +1210,33 @@ static mpc_err_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
 #define MPC_CONTINUE(st, x) mpc_stack_set_state(stk, st); mpc_stack_pushp(stk, x); continue
 #define MPC_SUCCESS(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_out(x), 1); continue
 #define MPC_FAILURE(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_err(x), 0); continue
-#define MPC_PRIMITIVE(x, f) if (f) { MPC_SUCCESS(x); } else { MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Incorrect Input")); }
+#define MPC_PRIMITIVE(x, f) if (f) { if (i->rerun) { mpc_free(x); x = NULL; } MPC_SUCCESS(x); } else { MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Incorrect Input")); }
+#define MPC_OUTPUT(x) (i->rerun ? NULL : (x))
+#define MPC_CALLBACK(f) (i->rerun ? NULL : (f))
 
-int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
+/*
+** A regex DFA only knows where a match ends, not the errors mpc would
+** have collected on the way, so when it fails it reports a placeholder.
+** Errors never steer a parse, and on success they are thrown away, but
+** a parse that fails after using a DFA is run again without them to get
+** the real message.
+**
+** That rerun is only after the error. Every result in it is NULL, and
+** no apply, fold, lift or destructor is called, so user callbacks run
+** once per parse whichever way it goes.
+*/
+
+/* The DFA to match p with, if it has one and the input allows it */
+static mpc_dfa_t *mpc_input_dfa(mpc_input_t *i, mpc_parser_t *p) {
+  if (p->type != MPC_TYPE_REGEX || p->data.regex.x->dfa == NULL) { return NULL; }
+  if (i->rerun || i->type != MPC_INPUT_STRING || i->backtrack < 1) { return NULL; }
+  i->dfa_used = 1;
+  return p->data.regex.x->dfa;
+}
+
+static mpc_ast_t *mpc_ast_leaf(mpc_input_t *i, mpc_state_t s, char *c);
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
   
   /* Stack */
   int st = 0;
@@ -971,7 +1245,11 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
   
   /* Variables */
   char *s;
+  long n;
   mpc_result_t r;
+  mpc_state_t start;
+  mpc_parser_t *x;
+  mpc_dfa_t *d;
 
   /* Go! */
   mpc_stack_pushp(stk, init);
@@ -997,9 +1275,9 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
       case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Parser Undefined!"));      
       case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
       case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i->filename, i->state, p->data.fail.m));
-      case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
-      case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
-      case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_state_copy(i->state));
+      case MPC_TYPE_LIFT:      MPC_SUCCESS(MPC_OUTPUT(p->data.lift.lf()));
+      case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(MPC_OUTPUT(p->data.lift.x));
+      case MPC_TYPE_STATE:     MPC_SUCCESS(MPC_OUTPUT(mpc_state_copy(i->state)));
       
       case MPC_TYPE_ANCHOR:
         if (mpc_input_anchor(i, p->data.anchor.f)) {
@@ -1025,7 +1303,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         if (st == 0) { MPC_CONTINUE(1, p->data.apply.x); }
         if (st == 1) {
           if (mpc_stack_popr(stk, &r)) {
-            MPC_SUCCESS(p->data.apply.f(r.output));
+            MPC_SUCCESS(MPC_OUTPUT(p->data.apply.f(r.output)));
           } else {
             MPC_FAILURE(r.error);
           }
@@ -1035,7 +1313,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         if (st == 0) { MPC_CONTINUE(1, p->data.apply_to.x); }
         if (st == 1) {
           if (mpc_stack_popr(stk, &r)) {
-            MPC_SUCCESS(p->data.apply_to.f(r.output, p->data.apply_to.d));
+            MPC_SUCCESS(MPC_OUTPUT(p->data.apply_to.f(r.output, p->data.apply_to.d)));
           } else {
             MPC_FAILURE(r.error);
           }
@@ -1058,12 +1336,12 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         if (st == 1) {
           if (mpc_stack_popr(stk, &r)) {
             mpc_input_rewind(i);
-            p->data.not.dx(r.output);
+            if (!i->rerun) { p->data.not.dx(r.output); }
             MPC_FAILURE(mpc_err_new(i->filename, i->state, "opposite", mpc_input_peekc(i)));
           } else {
             mpc_input_unmark(i);
             mpc_stack_err(stk, r.error);
-            MPC_SUCCESS(p->data.not.lf());
+            MPC_SUCCESS(MPC_OUTPUT(p->data.not.lf()));
           }
         }
       
@@ -1074,7 +1352,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
             MPC_SUCCESS(r.output);
           } else {
             mpc_stack_err(stk, r.error);
-            MPC_SUCCESS(p->data.not.lf());
+            MPC_SUCCESS(MPC_OUTPUT(p->data.not.lf()));
           }
         }
       
@@ -1088,7 +1366,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           } else {
             mpc_stack_popr(stk, &r);
             mpc_stack_err(stk, r.error);
-            MPC_SUCCESS(mpc_stack_merger_out(stk, st-1, p->data.repeat.f));
+            MPC_SUCCESS(mpc_stack_merger_out(stk, st-1, MPC_CALLBACK(p->data.repeat.f)));
           }
         }
       
@@ -1104,7 +1382,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
             } else {
               mpc_stack_popr(stk, &r);
               mpc_stack_err(stk, r.error);
-              MPC_SUCCESS(mpc_stack_merger_out(stk, st-1, p->data.repeat.f));
+              MPC_SUCCESS(mpc_stack_merger_out(stk, st-1, MPC_CALLBACK(p->data.repeat.f)));
             }
           }
         }
@@ -1114,7 +1392,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         if (st >  0) {
           if (!mpc_stack_peekr(stk, &r)) {
             mpc_stack_popr(stk, &r);
-            mpc_stack_popr_out_single(stk, st-1, p->data.repeat.dx);
+            mpc_stack_popr_out_single(stk, st-1, MPC_CALLBACK(p->data.repeat.dx));
             mpc_input_rewind(i);
             MPC_FAILURE(mpc_err_count(r.error, p->data.repeat.n));
           } else {
@@ -1122,7 +1400,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
               MPC_CONTINUE(st+1, p->data.repeat.x);
             } else {
               mpc_input_unmark(i);
-              MPC_SUCCESS(mpc_stack_merger_out(stk, st, p->data.repeat.f));
+              MPC_SUCCESS(mpc_stack_merger_out(stk, st, MPC_CALLBACK(p->data.repeat.f)));
             }
           }
         }
@@ -1146,18 +1424,71 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
       
       case MPC_TYPE_AND:
         
-        if (p->data.and.n == 0) { MPC_SUCCESS(p->data.and.f(0, NULL)); }
+        if (p->data.and.n == 0) { MPC_SUCCESS(MPC_OUTPUT(p->data.and.f(0, NULL))); }
         
         if (st == 0) { mpc_input_mark(i); MPC_CONTINUE(st+1, p->data.and.xs[st]); }
         if (st <= p->data.and.n) {
           if (!mpc_stack_peekr(stk, &r)) {
             mpc_input_rewind(i);
             mpc_stack_popr(stk, &r);
-            mpc_stack_popr_out(stk, st-1, p->data.and.dxs);
+            mpc_stack_popr_out(stk, st-1, MPC_CALLBACK(p->data.and.dxs));
             MPC_FAILURE(r.error);
           }
           if (st <  p->data.and.n) { MPC_CONTINUE(st+1, p->data.and.xs[st]); }
-          if (st == p->data.and.n) { mpc_input_unmark(i); MPC_SUCCESS(mpc_stack_merger_out(stk, p->data.and.n, p->data.and.f)); }
+          if (st == p->data.and.n) { mpc_input_unmark(i); MPC_SUCCESS(mpc_stack_merger_out(stk, p->data.and.n, MPC_CALLBACK(p->data.and.f))); }
+        }
+      
+      /* Regex Parsers */
+      
+      case MPC_TYPE_REGEX:
+        if (st == 0) {
+          if ((d = mpc_input_dfa(i, p))) {
+            n = mpc_dfa_match(d, i->string + i->state.pos);
+            if (n >= 0) { MPC_SUCCESS(mpc_input_take(i, n)); }
+            MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Regex Mismatch"));
+          }
+          MPC_CONTINUE(1, p->data.regex.x->x);
+        }
+        if (st == 1) {
+          if (mpc_stack_popr(stk, &r)) {
+            MPC_SUCCESS(r.output);
+          } else {
+            MPC_FAILURE(r.error);
+          }
+        }
+      
+      /* Leaf Parsers */
+      
+      case MPC_TYPE_LEAF:
+        x = p->data.leaf.x;
+        if (st == 0) {
+          if ((d = mpc_input_dfa(i, x))) {
+            n = mpc_dfa_match(d, i->string + i->state.pos);
+            if (n < 0) { MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Regex Mismatch")); }
+            start = i->state;
+            if (i->slices) {
+              mpc_input_skip(i, n);
+              s = NULL;
+            } else {
+              s = mpc_input_take(i, n);
+            }
+            MPC_SUCCESS(mpc_ast_leaf(i, start, s));
+          }
+          mpc_stack_pushr(stk, mpc_result_out(mpc_state_copy(i->state)), 1);
+          MPC_CONTINUE(1, x);
+        }
+        if (st == 1) {
+          if (mpc_stack_popr(stk, &r)) {
+            s = r.output;
+            mpc_stack_popr(stk, &r);
+            start = *(mpc_state_t*)r.output;
+            mpc_free(r.output);
+            if (i->slices || i->rerun) { mpc_free(s); s = NULL; }
+            MPC_SUCCESS(MPC_OUTPUT(mpc_ast_leaf(i, start, s)));
+          } else {
+            mpc_stack_popr_out_single(stk, 1, mpc_free);
+            MPC_FAILURE(r.error);
+          }
         }
       
       /* End */
@@ -1176,6 +1507,39 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
 #undef MPC_SUCCESS
 #undef MPC_FAILURE
 #undef MPC_PRIMITIVE
+#undef MPC_OUTPUT
+#undef MPC_CALLBACK
+
+int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
+  
+  int x;
+  int used = i->dfa_used;
+  mpc_state_t state = i->state;
+  char last = i->last;
+  int backtrack = i->backtrack;
+  int marks_num = i->marks_num;
+  mpc_result_t r;
+  
+  i->dfa_used = 0;
+  x = mpc_parse_run(i, init, final);
+  
+  /* Rerun for the error only, keeping this one should it pass */
+  if (!x && i->dfa_used) {
+    i->state = state;
+    i->last = last;
+    i->backtrack = backtrack;
+    i->marks_num = marks_num;
+    i->rerun++;
+    if (!mpc_parse_run(i, init, &r)) {
+      mpc_err_delete(final->error);
+      final->error = r.error;
+    }
+    i->rerun--;
+  }
+  
+  i->dfa_used = used;
+  return x;
+}
 
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
   int x;
@@ -1185,6 +1549,15 @@ int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_res
   return x;
 }
 
+int mpc_parse_slices(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_string(filename, string);
+  i->slices = string;
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
+}
+
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_file(filename, file);
@@ -1229,7 +1602,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
   for (i = 0; i < p->data.or.n; i++) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
-  free(p->data.or.xs);
+  mpc_free(p->data.or.xs);
   
 }
 
@@ -1239,8 +1612,8 @@ static void mpc_undefine_and(mpc_parser_t *p) {
   for (i = 0; i < p->data.and.n; i++) {
     mpc_undefine_unretained(p->data.and.xs[i], 0);
   }
-  free(p->data.and.xs);
-  free(p->data.and.dxs);
+  mpc_free(p->data.and.xs);
+  mpc_free(p->data.and.dxs);
   
 }
 
@@ -1250,17 +1623,18 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
   
   switch (p->type) {
     
-    case MPC_TYPE_FAIL: free(p->data.fail.m); break;
+    case MPC_TYPE_FAIL: mpc_free(p->data.fail.m); break;
     
     case MPC_TYPE_ONEOF: 
     case MPC_TYPE_NONEOF:
     case MPC_TYPE_STRING:
-      free(p->data.string.x); 
+      mpc_free(p->data.string.x); 
       break;
     
     case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    case MPC_TYPE_LEAF:     mpc_undefine_unretained(p->data.leaf.x, 0);     break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1269,7 +1643,7 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     
     case MPC_TYPE_EXPECT:
       mpc_undefine_unretained(p->data.expect.x, 0);
-      free(p->data.expect.m);
+      mpc_free(p->data.expect.m);
       break;
       
     case MPC_TYPE_MANY:
@@ -1281,12 +1655,14 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
     case MPC_TYPE_AND: mpc_undefine_and(p); break;
     
+    case MPC_TYPE_REGEX: mpc_regex_release(p->data.regex.x); break;
+    
     default: break;
   }
   
   if (!force) {
-    free(p->name);
-    free(p);
+    mpc_free(p->name);
+    mpc_free(p);
   }
   
 }
@@ -1298,8 +1674,8 @@ void mpc_delete(mpc_parser_t *p) {
       mpc_undefine_unretained(p, 0);
     } 
     
-    free(p->name);
-    free(p);
+    mpc_free(p->name);
+    mpc_free(p);
   
   } else {
     mpc_undefine_unretained(p, 0);  
@@ -1321,7 +1697,7 @@ static mpc_parser_t *mpc_undefined(void) {
 mpc_parser_t *mpc_new(const char *name) {
   mpc_parser_t *p = mpc_undefined();
   p->retained = 1;
-  p->name = realloc(p->name, strlen(name) + 1);
+  p->name = mpc_realloc(p->name, strlen(name) + 1);
   strcpy(p->name, name);
   return p;
 }
@@ -1341,16 +1717,16 @@ mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a) {
     mpc_parser_t *a2 = mpc_failf("Attempt to assign to Unretained Parser!");
     p->type = a2->type;
     p->data = a2->data;
-    free(a2);
+    mpc_free(a2);
   }
   
-  free(a);
+  mpc_free(a);
   return p;  
 }
 
 void mpc_cleanup(int n, ...) {
   int i;
-  mpc_parser_t **list = malloc(sizeof(mpc_parser_t*) * n);
+  mpc_parser_t **list = mpc_malloc(sizeof(mpc_parser_t*) * n);
   
   va_list va;
   va_start(va, n);
@@ -1359,7 +1735,7 @@ void mpc_cleanup(int n, ...) {
   for (i = 0; i < n; i++) { mpc_delete(list[i]); }  
   va_end(va);  
 
-  free(list);
+  mpc_free(list);
 }
 
 mpc_parser_t *mpc_pass(void) {
@@ -1371,7 +1747,7 @@ mpc_parser_t *mpc_pass(void) {
 mpc_parser_t *mpc_fail(const char *m) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_FAIL;
-  p->data.fail.m = malloc(strlen(m) + 1);
+  p->data.fail.m = mpc_malloc(strlen(m) + 1);
   strcpy(p->data.fail.m, m);
   return p;
 }
@@ -1405,11 +1781,11 @@ mpc_parser_t *mpc_failf(const char *fmt, ...) {
   p->type = MPC_TYPE_FAIL;
   
   va_start(va, fmt);
-  buffer = malloc(2048);
+  buffer = mpc_malloc(2048);
   vsprintf(buffer, fmt, va);
   va_end(va);
   
-  buffer = realloc(buffer, strlen(buffer) + 1);
+  buffer = mpc_realloc(buffer, strlen(buffer) + 1);
   p->data.fail.m = buffer;
   return p;
 
@@ -1446,7 +1822,7 @@ mpc_parser_t *mpc_expect(mpc_parser_t *a, const char *expected) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_EXPECT;
   p->data.expect.x = a;
-  p->data.expect.m = malloc(strlen(expected) + 1);
+  p->data.expect.m = mpc_malloc(strlen(expected) + 1);
   strcpy(p->data.expect.m, expected);
   return p;
 }
@@ -1479,11 +1855,11 @@ mpc_parser_t *mpc_expectf(mpc_parser_t *a, const char *fmt, ...) {
   p->type = MPC_TYPE_EXPECT;
   
   va_start(va, fmt);
-  buffer = malloc(2048);
+  buffer = mpc_malloc(2048);
   vsprintf(buffer, fmt, va);
   va_end(va);
   
-  buffer = realloc(buffer, strlen(buffer) + 1);
+  buffer = mpc_realloc(buffer, strlen(buffer) + 1);
   p->data.expect.x = a;
   p->data.expect.m = buffer;
   return p;
@@ -1517,7 +1893,7 @@ mpc_parser_t *mpc_range(char s, char e) {
 mpc_parser_t *mpc_oneof(const char *s) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_ONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
+  p->data.string.x = mpc_malloc(strlen(s) + 1);
   strcpy(p->data.string.x, s);
   return mpc_expectf(p, "one of '%s'", s);
 }
@@ -1525,7 +1901,7 @@ mpc_parser_t *mpc_oneof(const char *s) {
 mpc_parser_t *mpc_noneof(const char *s) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
+  p->data.string.x = mpc_malloc(strlen(s) + 1);
   strcpy(p->data.string.x, s);
   return mpc_expectf(p, "one of '%s'", s);
 
@@ -1541,7 +1917,7 @@ mpc_parser_t *mpc_satisfy(int(*f)(char)) {
 mpc_parser_t *mpc_string(const char *s) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_STRING;
-  p->data.string.x = malloc(strlen(s) + 1);
+  p->data.string.x = mpc_malloc(strlen(s) + 1);
   strcpy(p->data.string.x, s);
   return mpc_expectf(p, "\"%s\"", s);
 }
@@ -1634,7 +2010,7 @@ mpc_parser_t *mpc_or(int n, ...) {
   
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
-  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.xs = mpc_malloc(sizeof(mpc_parser_t*) * n);
   
   va_start(va, n);  
   for (i = 0; i < n; i++) {
@@ -1655,8 +2031,8 @@ mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...) {
   p->type = MPC_TYPE_AND;
   p->data.and.n = n;
   p->data.and.f = f;
-  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
-  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n-1));
+  p->data.and.xs = mpc_malloc(sizeof(mpc_parser_t*) * n);
+  p->data.and.dxs = mpc_malloc(sizeof(mpc_dtor_t) * (n-1));
 
   va_start(va, f);  
   for (i = 0; i < n; i++) {
@@ -1699,7 +2075,7 @@ mpc_parser_t *mpc_blank(void) { return mpc_expect(mpc_apply(mpc_whitespaces(), m
 
 mpc_parser_t *mpc_newline(void) { return mpc_expect(mpc_char('\n'), "newline"); }
 mpc_parser_t *mpc_tab(void) { return mpc_expect(mpc_char('\t'), "tab"); }
-mpc_parser_t *mpc_escape(void) { return mpc_and(2, mpcf_strfold, mpc_char('\\'), mpc_any(), free); }
+mpc_parser_t *mpc_escape(void) { return mpc_and(2, mpcf_strfold, mpc_char('\\'), mpc_any(), mpc_free); }
 
 mpc_parser_t *mpc_digit(void) { return mpc_expect(mpc_oneof("0123456789"), "digit"); }
 mpc_parser_t *mpc_hexdigit(void) { return mpc_expect(mpc_oneof("0123456789ABCDEFabcdef"), "hex digit"); }
@@ -1727,13 +2103,13 @@ mpc_parser_t *mpc_real(void) {
   
   p0 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
   p1 = mpc_digits();
-  p2 = mpc_maybe_lift(mpc_and(2, mpcf_strfold, mpc_char('.'), mpc_digits(), free), mpcf_ctor_str);
+  p2 = mpc_maybe_lift(mpc_and(2, mpcf_strfold, mpc_char('.'), mpc_digits(), mpc_free), mpcf_ctor_str);
   p30 = mpc_oneof("eE");
   p31 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
   p32 = mpc_digits();
-  p3 = mpc_maybe_lift(mpc_and(3, mpcf_strfold, p30, p31, p32, free, free), mpcf_ctor_str);
+  p3 = mpc_maybe_lift(mpc_and(3, mpcf_strfold, p30, p31, p32, mpc_free, mpc_free), mpcf_ctor_str);
   
-  return mpc_expect(mpc_and(4, mpcf_strfold, p0, p1, p2, p3, free, free, free), "real");
+  return mpc_expect(mpc_and(4, mpcf_strfold, p0, p1, p2, p3, mpc_free, mpc_free, mpc_free), "real");
 
 }
 
@@ -1742,24 +2118,24 @@ mpc_parser_t *mpc_float(void) {
 }
 
 mpc_parser_t *mpc_char_lit(void) {
-  return mpc_expect(mpc_between(mpc_or(2, mpc_escape(), mpc_any()), free, "'", "'"), "char");
+  return mpc_expect(mpc_between(mpc_or(2, mpc_escape(), mpc_any()), mpc_free, "'", "'"), "char");
 }
 
 mpc_parser_t *mpc_string_lit(void) {
   mpc_parser_t *strchar = mpc_or(2, mpc_escape(), mpc_noneof("\""));
-  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, strchar), free, "\"", "\""), "string");
+  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, strchar), mpc_free, "\"", "\""), "string");
 }
 
 mpc_parser_t *mpc_regex_lit(void) {  
   mpc_parser_t *regexchar = mpc_or(2, mpc_escape(), mpc_noneof("/"));
-  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, regexchar), free, "/", "/"), "regex");
+  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, regexchar), mpc_free, "/", "/"), "regex");
 }
 
 mpc_parser_t *mpc_ident(void) {
   mpc_parser_t *p0, *p1; 
   p0 = mpc_or(2, mpc_alpha(), mpc_underscore());
   p1 = mpc_many(mpcf_strfold, mpc_alphanum()); 
-  return mpc_and(2, mpcf_strfold, p0, p1, free);
+  return mpc_and(2, mpcf_strfold, p0, p1, mpc_free);
 }
 
 /*
@@ -1781,7 +2157,7 @@ mpc_parser_t *mpc_total(mpc_parser_t *a, mpc_dtor_t da) { return mpc_whole(mpc_s
 mpc_parser_t *mpc_between(mpc_parser_t *a, mpc_dtor_t ad, const char *o, const char *c) {
   return mpc_and(3, mpcf_snd_free,
     mpc_string(o), a, mpc_string(c),
-    free, ad);
+    mpc_free, ad);
 }
 
 mpc_parser_t *mpc_parens(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_between(a, ad, "(", ")"); }
@@ -1792,7 +2168,7 @@ mpc_parser_t *mpc_squares(mpc_parser_t *a, mpc_dtor_t ad)  { return mpc_between(
 mpc_parser_t *mpc_tok_between(mpc_parser_t *a, mpc_dtor_t ad, const char *o, const char *c) {
   return mpc_and(3, mpcf_snd_free,
     mpc_sym(o), mpc_tok(a), mpc_sym(c),
-    free, ad);
+    mpc_free, ad);
 }
 
 mpc_parser_t *mpc_tok_parens(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_tok_between(a, ad, "(", ")"); }
@@ -1860,7 +2236,7 @@ static mpc_val_t *mpcf_re_and(int n, mpc_val_t **xs) {
   int i;
   mpc_parser_t *p = mpc_lift(mpcf_ctor_str);
   for (i = 0; i < n; i++) {
-    p = mpc_and(2, mpcf_strfold, p, xs[i], free);
+    p = mpc_and(2, mpcf_strfold, p, xs[i], mpc_free);
   }
   return p;
 }
@@ -1869,13 +2245,13 @@ static mpc_val_t *mpcf_re_repeat(int n, mpc_val_t **xs) {
   int num;
   (void) n;
   if (xs[1] == NULL) { return xs[0]; }
-  if (strcmp(xs[1], "*") == 0) { free(xs[1]); return mpc_many(mpcf_strfold, xs[0]); }
-  if (strcmp(xs[1], "+") == 0) { free(xs[1]); return mpc_many1(mpcf_strfold, xs[0]); }
-  if (strcmp(xs[1], "?") == 0) { free(xs[1]); return mpc_maybe_lift(xs[0], mpcf_ctor_str); }
+  if (strcmp(xs[1], "*") == 0) { mpc_free(xs[1]); return mpc_many(mpcf_strfold, xs[0]); }
+  if (strcmp(xs[1], "+") == 0) { mpc_free(xs[1]); return mpc_many1(mpcf_strfold, xs[0]); }
+  if (strcmp(xs[1], "?") == 0) { mpc_free(xs[1]); return mpc_maybe_lift(xs[0], mpcf_ctor_str); }
   num = *(int*)xs[1];
-  free(xs[1]);
+  mpc_free(xs[1]);
   
-  return mpc_count(num, mpcf_strfold, xs[0], free);
+  return mpc_count(num, mpcf_strfold, xs[0], mpc_free);
 }
 
 static mpc_parser_t *mpc_re_escape_char(char c) {
@@ -1886,16 +2262,16 @@ static mpc_parser_t *mpc_re_escape_char(char c) {
     case 'r': return mpc_char('\r');
     case 't': return mpc_char('\t');
     case 'v': return mpc_char('\v');
-    case 'b': return mpc_and(2, mpcf_snd, mpc_boundary(), mpc_lift(mpcf_ctor_str), free);
-    case 'B': return mpc_not_lift(mpc_boundary(), free, mpcf_ctor_str);
-    case 'A': return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
-    case 'Z': return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free);
+    case 'b': return mpc_and(2, mpcf_snd, mpc_boundary(), mpc_lift(mpcf_ctor_str), mpc_free);
+    case 'B': return mpc_not_lift(mpc_boundary(), mpc_free, mpcf_ctor_str);
+    case 'A': return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), mpc_free);
+    case 'Z': return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), mpc_free);
     case 'd': return mpc_digit();
-    case 'D': return mpc_not_lift(mpc_digit(), free, mpcf_ctor_str);
+    case 'D': return mpc_not_lift(mpc_digit(), mpc_free, mpcf_ctor_str);
     case 's': return mpc_whitespace();
-    case 'S': return mpc_not_lift(mpc_whitespace(), free, mpcf_ctor_str);
+    case 'S': return mpc_not_lift(mpc_whitespace(), mpc_free, mpcf_ctor_str);
     case 'w': return mpc_alphanum();
-    case 'W': return mpc_not_lift(mpc_alphanum(), free, mpcf_ctor_str);
+    case 'W': return mpc_not_lift(mpc_alphanum(), mpc_free, mpcf_ctor_str);
     default: return NULL;
   }
 }
@@ -1906,21 +2282,21 @@ static mpc_val_t *mpcf_re_escape(mpc_val_t *x) {
   mpc_parser_t *p;
   
   /* Regex Special Characters */
-  if (s[0] == '.') { free(s); return mpc_any(); }
-  if (s[0] == '^') { free(s); return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free); }
-  if (s[0] == '$') { free(s); return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free); }
+  if (s[0] == '.') { mpc_free(s); return mpc_any(); }
+  if (s[0] == '^') { mpc_free(s); return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), mpc_free); }
+  if (s[0] == '$') { mpc_free(s); return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), mpc_free); }
   
   /* Regex Escape */
   if (s[0] == '\\') {
     p = mpc_re_escape_char(s[1]);
     p = (p == NULL) ? mpc_char(s[1]) : p;
-    free(s);
+    mpc_free(s);
     return p;
   }
   
   /* Regex Standard */
   p = mpc_char(s[0]);
-  free(s);
+  mpc_free(s);
   return p;
 }
 
@@ -1949,11 +2325,11 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   const char *tmp = NULL;
   const char *s = x;
   int comp = s[0] == '^' ? 1 : 0;
-  char *range = calloc(1,1);
+  char *range = mpc_calloc(1,1);
   
-  if (s[0] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); } 
+  if (s[0] == '\0') { mpc_free(x); return mpc_fail("Invalid Regex Range Expression"); } 
   if (s[0] == '^' && 
-      s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+      s[1] == '\0') { mpc_free(x); return mpc_fail("Invalid Regex Range Expression"); }
   
   for (i = comp; i < strlen(s); i++){
     
@@ -1961,10 +2337,10 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
     if (s[i] == '\\') {
       tmp = mpc_re_range_escape_char(s[i+1]);
       if (tmp != NULL) {
-        range = realloc(range, strlen(range) + strlen(tmp) + 1);
+        range = mpc_realloc(range, strlen(range) + strlen(tmp) + 1);
         strcat(range, tmp);
       } else {
-        range = realloc(range, strlen(range) + 1 + 1);
+        range = mpc_realloc(range, strlen(range) + 1 + 1);
         range[strlen(range) + 1] = '\0';
         range[strlen(range) + 0] = s[i+1];      
       }
@@ -1974,13 +2350,13 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
     /* Regex Range...Range */
     else if (s[i] == '-') {
       if (s[i+1] == '\0' || i == 0) {
-          range = realloc(range, strlen(range) + strlen("-") + 1);
+          range = mpc_realloc(range, strlen(range) + strlen("-") + 1);
           strcat(range, "-");
       } else {
         start = s[i-1]+1;
         end = s[i+1]-1;
         for (j = start; j <= end; j++) {
-          range = realloc(range, strlen(range) + 1 + 1);
+          range = mpc_realloc(range, strlen(range) + 1 + 1);
           range[strlen(range) + 1] = '\0';
           range[strlen(range) + 0] = j;
         }        
@@ -1989,7 +2365,7 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
     
     /* Regex Range Normal */
     else {
-      range = realloc(range, strlen(range) + 1 + 1);
+      range = mpc_realloc(range, strlen(range) + 1 + 1);
       range[strlen(range) + 1] = '\0';
       range[strlen(range) + 0] = s[i];
     }
@@ -1998,13 +2374,13 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   
   out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
   
-  free(x);
-  free(range);
+  mpc_free(x);
+  mpc_free(range);
   
   return out;
 }
 
-mpc_parser_t *mpc_re(const char *re) {
+static mpc_parser_t *mpc_re_parser(const char *re) {
   
   char *err_msg;
   mpc_parser_t *err_out;
@@ -2019,7 +2395,7 @@ mpc_parser_t *mpc_re(const char *re) {
   
   mpc_define(Regex, mpc_and(2, mpcf_re_or,
     Term, 
-    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, free)),
+    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, mpc_free)),
     (mpc_dtor_t)mpc_delete
   ));
   
@@ -2029,7 +2405,7 @@ mpc_parser_t *mpc_re(const char *re) {
     Base,
     mpc_or(5,
       mpc_char('*'), mpc_char('+'), mpc_char('?'),
-      mpc_brackets(mpc_int(), free),
+      mpc_brackets(mpc_int(), mpc_free),
       mpc_pass()),
     (mpc_dtor_t)mpc_delete
   ));
@@ -2052,7 +2428,7 @@ mpc_parser_t *mpc_re(const char *re) {
     err_msg = mpc_err_string(r.error);
     err_out = mpc_failf("Invalid Regex: %s", err_msg);
     mpc_err_delete(r.error);  
-    free(err_msg);
+    mpc_free(err_msg);
     r.output = err_out;
   }
   
@@ -2063,6 +2439,506 @@ mpc_parser_t *mpc_re(const char *re) {
   
 }
 
+/*
+** Regular Expression DFAs
+**
+** The parser a regex is built into is also compiled into a DFA when it
+** is made only of characters, sets, sequences, choices and repeats that
+** output the text they consume, and when it is LL(1): choices start with
+** different characters, and nothing optional or repeated can start with
+** a character that may follow it. For those the match mpc would find is
+** the longest one, which is what the DFA finds. Anchors and the escapes
+** that look around are left to the parser.
+**
+** The DFA is built from the Glushkov automaton of the regex, using the
+** positions of its character sets as NFA states, by subset construction
+** over byte classes, and is then minimised.
+*/
+
+#define MPC_DFA_POSITIONS 255
+#define MPC_DFA_STATES 256
+#define MPC_DFA_NODES 4096
+
+typedef struct { unsigned int w[8]; } mpc_dfa_set_t;
+
+static int mpc_dfa_set_has(const mpc_dfa_set_t *s, int i) {
+  return (s->w[i >> 5] >> (i & 31)) & 1;
+}
+
+static void mpc_dfa_set_add(mpc_dfa_set_t *s, int i) {
+  s->w[i >> 5] |= 1u << (i & 31);
+}
+
+static void mpc_dfa_set_union(mpc_dfa_set_t *s, const mpc_dfa_set_t *t) {
+  int k;
+  for (k = 0; k < 8; k++) { s->w[k] |= t->w[k]; }
+}
+
+static int mpc_dfa_set_meets(const mpc_dfa_set_t *s, const mpc_dfa_set_t *t) {
+  int k;
+  for (k = 0; k < 8; k++) { if (s->w[k] & t->w[k]) { return 1; } }
+  return 0;
+}
+
+static int mpc_dfa_set_empty(const mpc_dfa_set_t *s) {
+  int k;
+  for (k = 0; k < 8; k++) { if (s->w[k]) { return 0; } }
+  return 1;
+}
+
+enum {
+  MPC_RE_EMPTY = 0,
+  MPC_RE_SET   = 1,
+  MPC_RE_AND   = 2,
+  MPC_RE_OR    = 3,
+  MPC_RE_MANY  = 4,
+  MPC_RE_MAYBE = 5
+};
+
+typedef struct mpc_re_node_t {
+  int type;
+  int n;
+  struct mpc_re_node_t **xs;
+  int pos;
+  int nullable;
+  mpc_dfa_set_t chars;
+  mpc_dfa_set_t first;
+  mpc_dfa_set_t last;
+} mpc_re_node_t;
+
+typedef struct {
+  int nodes_num;
+  mpc_re_node_t **nodes;
+  int positions_num;
+  mpc_dfa_set_t chars[MPC_DFA_POSITIONS];
+  mpc_dfa_set_t follow[MPC_DFA_POSITIONS+1];
+} mpc_dfa_build_t;
+
+static mpc_re_node_t *mpc_re_node_new(mpc_dfa_build_t *b, int type, int n) {
+  
+  mpc_re_node_t *x;
+  
+  if (b->nodes_num == MPC_DFA_NODES) { return NULL; }
+  
+  x = mpc_calloc(1, sizeof(mpc_re_node_t));
+  x->type = type;
+  x->n = n;
+  x->xs = mpc_calloc(n + 1, sizeof(mpc_re_node_t*));
+  
+  b->nodes = mpc_realloc(b->nodes, sizeof(mpc_re_node_t*) * (b->nodes_num + 1));
+  b->nodes[b->nodes_num++] = x;
+  return x;
+}
+
+static int mpc_re_node_has(mpc_parser_t *p, char c) {
+  switch (p->type) {
+    case MPC_TYPE_ANY:    return 1;
+    case MPC_TYPE_SINGLE: return c == p->data.single.x;
+    case MPC_TYPE_RANGE:  return c >= p->data.range.x && c <= p->data.range.y;
+    case MPC_TYPE_ONEOF:  return strchr(p->data.string.x, c) != 0;
+    case MPC_TYPE_NONEOF: return strchr(p->data.string.x, c) == 0;
+    default: return 0;
+  }
+}
+
+static mpc_re_node_t *mpc_re_node(mpc_dfa_build_t *b, mpc_parser_t *p);
+
+static mpc_re_node_t *mpc_re_node_set(mpc_dfa_build_t *b, mpc_parser_t *p) {
+  
+  int c;
+  mpc_re_node_t *x;
+  
+  if (b->positions_num == MPC_DFA_POSITIONS) { return NULL; }
+  
+  x = mpc_re_node_new(b, MPC_RE_SET, 0);
+  if (x == NULL) { return NULL; }
+  
+  /* The end of the input is never matched */
+  for (c = 1; c < 256; c++) {
+    if (mpc_re_node_has(p, (char)c)) { mpc_dfa_set_add(&x->chars, c); }
+  }
+  
+  x->pos = b->positions_num++;
+  b->chars[x->pos] = x->chars;
+  return x;
+}
+
+static mpc_re_node_t *mpc_re_node_seq(mpc_dfa_build_t *b, int type, int n, mpc_parser_t **xs, mpc_parser_t *y) {
+  
+  int i;
+  mpc_re_node_t *x = mpc_re_node_new(b, type, n);
+  if (x == NULL) { return NULL; }
+  
+  for (i = 0; i < n; i++) {
+    x->xs[i] = mpc_re_node(b, xs ? xs[i] : y);
+    if (x->xs[i] == NULL) { return NULL; }
+  }
+  
+  return x;
+}
+
+static mpc_re_node_t *mpc_re_node(mpc_dfa_build_t *b, mpc_parser_t *p) {
+  
+  mpc_re_node_t *x;
+  
+  if (p->retained) { return NULL; }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_EXPECT: return mpc_re_node(b, p->data.expect.x);
+    
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      return mpc_re_node_set(b, p);
+    
+    case MPC_TYPE_LIFT:
+      if (p->data.lift.lf != mpcf_ctor_str) { return NULL; }
+      return mpc_re_node_new(b, MPC_RE_EMPTY, 0);
+    
+    case MPC_TYPE_MAYBE:
+      if (p->data.not.lf != mpcf_ctor_str) { return NULL; }
+      return mpc_re_node_seq(b, MPC_RE_MAYBE, 1, NULL, p->data.not.x);
+    
+    case MPC_TYPE_MANY:
+      if (p->data.repeat.f != mpcf_strfold) { return NULL; }
+      return mpc_re_node_seq(b, MPC_RE_MANY, 1, NULL, p->data.repeat.x);
+    
+    case MPC_TYPE_MANY1:
+      if (p->data.repeat.f != mpcf_strfold) { return NULL; }
+      x = mpc_re_node_seq(b, MPC_RE_AND, 1, NULL, p->data.repeat.x);
+      if (x == NULL) { return NULL; }
+      x->xs[1] = mpc_re_node_seq(b, MPC_RE_MANY, 1, NULL, p->data.repeat.x);
+      x->n = 2;
+      return x->xs[1] ? x : NULL;
+    
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.f != mpcf_strfold || p->data.repeat.n < 1) { return NULL; }
+      return mpc_re_node_seq(b, MPC_RE_AND, p->data.repeat.n, NULL, p->data.repeat.x);
+    
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { return NULL; }
+      return mpc_re_node_seq(b, MPC_RE_OR, p->data.or.n, p->data.or.xs, NULL);
+    
+    case MPC_TYPE_AND:
+      if (p->data.and.f != mpcf_strfold) { return NULL; }
+      return mpc_re_node_seq(b, MPC_RE_AND, p->data.and.n, p->data.and.xs, NULL);
+    
+    default: return NULL;
+  }
+  
+}
+
+static void mpc_re_follow(mpc_dfa_build_t *b, const mpc_dfa_set_t *last, const mpc_dfa_set_t *first) {
+  int i;
+  for (i = 0; i < b->positions_num; i++) {
+    if (mpc_dfa_set_has(last, i)) { mpc_dfa_set_union(&b->follow[i], first); }
+  }
+}
+
+static void mpc_re_glushkov(mpc_dfa_build_t *b, mpc_re_node_t *x) {
+  
+  int i, j;
+  
+  switch (x->type) {
+    
+    case MPC_RE_EMPTY:
+      x->nullable = 1;
+      break;
+    
+    case MPC_RE_SET:
+      mpc_dfa_set_add(&x->first, x->pos);
+      mpc_dfa_set_add(&x->last, x->pos);
+      break;
+    
+    case MPC_RE_AND:
+      x->nullable = 1;
+      for (i = 0; i < x->n; i++) {
+        mpc_re_glushkov(b, x->xs[i]);
+        if (x->nullable) {
+          mpc_dfa_set_union(&x->first, &x->xs[i]->first);
+          mpc_dfa_set_union(&x->chars, &x->xs[i]->chars);
+        }
+        x->nullable = x->nullable && x->xs[i]->nullable;
+      }
+      for (i = x->n-1; i >= 0; i--) {
+        mpc_dfa_set_union(&x->last, &x->xs[i]->last);
+        if (!x->xs[i]->nullable) { break; }
+      }
+      for (i = 0; i < x->n-1; i++) {
+        for (j = i+1; j < x->n; j++) {
+          mpc_re_follow(b, &x->xs[i]->last, &x->xs[j]->first);
+          if (!x->xs[j]->nullable) { break; }
+        }
+      }
+      break;
+    
+    case MPC_RE_OR:
+      for (i = 0; i < x->n; i++) {
+        mpc_re_glushkov(b, x->xs[i]);
+        mpc_dfa_set_union(&x->first, &x->xs[i]->first);
+        mpc_dfa_set_union(&x->last, &x->xs[i]->last);
+        mpc_dfa_set_union(&x->chars, &x->xs[i]->chars);
+        x->nullable = x->nullable || x->xs[i]->nullable;
+      }
+      break;
+    
+    case MPC_RE_MANY:
+    case MPC_RE_MAYBE:
+      mpc_re_glushkov(b, x->xs[0]);
+      x->first = x->xs[0]->first;
+      x->last = x->xs[0]->last;
+      x->chars = x->xs[0]->chars;
+      x->nullable = 1;
+      if (x->type == MPC_RE_MANY) { mpc_re_follow(b, &x->last, &x->first); }
+      break;
+  }
+  
+}
+
+/* Checks one character of lookahead picks the same path mpc would take */
+static int mpc_re_ll1(mpc_re_node_t *x, const mpc_dfa_set_t *follow) {
+  
+  int i, j;
+  mpc_dfa_set_t f;
+  mpc_re_node_t *y;
+  
+  switch (x->type) {
+    
+    case MPC_RE_AND:
+      f = *follow;
+      for (i = x->n-1; i >= 0; i--) {
+        if (!mpc_re_ll1(x->xs[i], &f)) { return 0; }
+        if (!x->xs[i]->nullable) { memset(&f, 0, sizeof(f)); }
+        mpc_dfa_set_union(&f, &x->xs[i]->chars);
+      }
+      return 1;
+    
+    case MPC_RE_OR:
+      for (i = 0; i < x->n; i++) {
+        y = x->xs[i];
+        if (y->nullable && i < x->n-1) { return 0; }
+        if (x->nullable && mpc_dfa_set_meets(&y->chars, follow)) { return 0; }
+        for (j = 0; j < i; j++) {
+          if (mpc_dfa_set_meets(&y->chars, &x->xs[j]->chars)) { return 0; }
+        }
+        if (!mpc_re_ll1(y, follow)) { return 0; }
+      }
+      return 1;
+    
+    case MPC_RE_MANY:
+    case MPC_RE_MAYBE:
+      y = x->xs[0];
+      if (y->nullable || mpc_dfa_set_meets(&y->chars, follow)) { return 0; }
+      f = *follow;
+      if (x->type == MPC_RE_MANY) { mpc_dfa_set_union(&f, &y->chars); }
+      return mpc_re_ll1(y, &f);
+    
+    default: return 1;
+  }
+  
+}
+
+static mpc_dfa_t *mpc_dfa_build(mpc_dfa_build_t *b, mpc_re_node_t *root) {
+  
+  int c, i, k, n, q, t;
+  int start = b->positions_num;
+  int classes_num = 0, states_num = 1, blocks_num, prev;
+  unsigned char classes[256];
+  mpc_dfa_set_t sig, reach, next;
+  mpc_dfa_set_t *sigs = mpc_malloc(sizeof(mpc_dfa_set_t) * 256);
+  mpc_dfa_set_t *states = mpc_malloc(sizeof(mpc_dfa_set_t) * MPC_DFA_STATES);
+  int *trans = NULL, *block, *next_block, *swap;
+  char *accept = mpc_malloc(MPC_DFA_STATES);
+  mpc_dfa_t *d = NULL;
+  
+  /* Bytes in the same sets are one class */
+  for (c = 0; c < 256; c++) {
+    memset(&sig, 0, sizeof(sig));
+    for (i = 0; i < start; i++) {
+      if (mpc_dfa_set_has(&b->chars[i], c)) { mpc_dfa_set_add(&sig, i); }
+    }
+    for (k = 0; k < classes_num; k++) {
+      if (memcmp(&sigs[k], &sig, sizeof(sig)) == 0) { break; }
+    }
+    if (k == classes_num) { sigs[classes_num++] = sig; }
+    classes[c] = k;
+  }
+  
+  /* Subset construction, from a start position before the regex */
+  trans = mpc_malloc(sizeof(int) * MPC_DFA_STATES * classes_num);
+  b->follow[start] = root->first;
+  memset(&states[0], 0, sizeof(mpc_dfa_set_t));
+  mpc_dfa_set_add(&states[0], start);
+  
+  for (q = 0; q < states_num; q++) {
+    
+    accept[q] = mpc_dfa_set_meets(&states[q], &root->last)
+      || (q == 0 && root->nullable);
+    
+    memset(&reach, 0, sizeof(reach));
+    for (i = 0; i <= start; i++) {
+      if (mpc_dfa_set_has(&states[q], i)) { mpc_dfa_set_union(&reach, &b->follow[i]); }
+    }
+    
+    for (k = 0; k < classes_num; k++) {
+      for (i = 0; i < 8; i++) { next.w[i] = reach.w[i] & sigs[k].w[i]; }
+      if (mpc_dfa_set_empty(&next)) { trans[q * classes_num + k] = -1; continue; }
+      for (n = 0; n < states_num; n++) {
+        if (memcmp(&states[n], &next, sizeof(next)) == 0) { break; }
+      }
+      if (n == states_num) {
+        if (states_num == MPC_DFA_STATES) { goto done; }
+        states[states_num++] = next;
+      }
+      trans[q * classes_num + k] = n;
+    }
+  }
+  
+  /* Minimise by splitting states apart until nothing changes */
+  block = mpc_malloc(sizeof(int) * states_num);
+  next_block = mpc_malloc(sizeof(int) * states_num);
+  prev = 0;
+  for (q = 0; q < states_num; q++) { block[q] = accept[q]; }
+  for (q = 0; q < states_num; q++) { if (accept[q]) { prev = 1; } }
+  for (q = 0; q < states_num; q++) { if (!accept[q]) { prev++; break; } }
+  
+  while (1) {
+    blocks_num = 0;
+    for (q = 0; q < states_num; q++) {
+      for (n = 0; n < q; n++) {
+        if (block[n] != block[q]) { continue; }
+        for (k = 0; k < classes_num; k++) {
+          t = trans[n * classes_num + k];
+          c = trans[q * classes_num + k];
+          if ((t < 0 ? -1 : block[t]) != (c < 0 ? -1 : block[c])) { break; }
+        }
+        if (k == classes_num) { break; }
+      }
+      next_block[q] = n < q ? next_block[n] : blocks_num++;
+    }
+    swap = block; block = next_block; next_block = swap;
+    if (blocks_num == prev) { break; }
+    prev = blocks_num;
+  }
+  
+  d = mpc_malloc(sizeof(mpc_dfa_t));
+  d->classes_num = classes_num;
+  d->states_num = blocks_num;
+  memcpy(d->classes, classes, sizeof(classes));
+  d->trans = mpc_malloc(sizeof(int) * blocks_num * classes_num);
+  d->accept = mpc_malloc(blocks_num);
+  
+  for (q = 0; q < states_num; q++) {
+    d->accept[block[q]] = accept[q];
+    for (k = 0; k < classes_num; k++) {
+      t = trans[q * classes_num + k];
+      d->trans[block[q] * classes_num + k] = t < 0 ? -1 : block[t];
+    }
+  }
+  
+  mpc_free(block);
+  mpc_free(next_block);
+  
+done:
+  mpc_free(sigs);
+  mpc_free(states);
+  mpc_free(trans);
+  mpc_free(accept);
+  return d;
+}
+
+static mpc_dfa_t *mpc_dfa_compile(mpc_parser_t *p) {
+  
+  int i;
+  mpc_dfa_set_t none;
+  mpc_dfa_t *d = NULL;
+  mpc_dfa_build_t *b = mpc_calloc(1, sizeof(mpc_dfa_build_t));
+  mpc_re_node_t *x = mpc_re_node(b, p);
+  
+  memset(&none, 0, sizeof(none));
+  
+  if (x != NULL) {
+    mpc_re_glushkov(b, x);
+    if (mpc_re_ll1(x, &none)) { d = mpc_dfa_build(b, x); }
+  }
+  
+  for (i = 0; i < b->nodes_num; i++) {
+    mpc_free(b->nodes[i]->xs);
+    mpc_free(b->nodes[i]);
+  }
+  mpc_free(b->nodes);
+  mpc_free(b);
+  
+  return d;
+}
+
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  if (d == NULL) { return; }
+  mpc_free(d->trans);
+  mpc_free(d->accept);
+  mpc_free(d);
+}
+
+/*
+** Parsers for the same regex share one entry. Regexes built inside an
+** arena get an entry of their own, as a shared one would outlive it.
+*/
+
+static mpc_regex_t *mpc_regexes = NULL;
+
+static void mpc_regex_release(mpc_regex_t *x) {
+  
+  mpc_regex_t **y;
+  
+  if (--x->refs > 0) { return; }
+  
+  if (x->shared) {
+    y = &mpc_regexes;
+    while (*y != x) { y = &(*y)->next; }
+    *y = x->next;
+  }
+  
+  mpc_delete(x->x);
+  mpc_dfa_delete(x->dfa);
+  mpc_free(x->re);
+  mpc_free(x);
+}
+
+mpc_parser_t *mpc_re(const char *re) {
+  
+  mpc_regex_t *x;
+  mpc_parser_t *p;
+  
+  for (x = mpc_regexes; x != NULL; x = x->next) {
+    if (strcmp(x->re, re) == 0) { break; }
+  }
+  
+  if (x == NULL) {
+    x = mpc_malloc(sizeof(mpc_regex_t));
+    x->re = mpc_malloc(strlen(re) + 1);
+    strcpy(x->re, re);
+    x->refs = 0;
+    x->shared = mpc_arena_current == NULL;
+    x->x = mpc_re_parser(re);
+    x->dfa = mpc_dfa_compile(x->x);
+    x->next = NULL;
+    if (x->shared) {
+      x->next = mpc_regexes;
+      mpc_regexes = x;
+    }
+  }
+  
+  x->refs++;
+  
+  p = mpc_undefined();
+  p->type = MPC_TYPE_REGEX;
+  p->data.regex.x = x;
+  return p;
+}
+
 /*
 ** Common Fold Functions
 */
@@ -2070,34 +2946,34 @@ mpc_parser_t *mpc_re(const char *re) {
 void mpcf_dtor_null(mpc_val_t *x) { (void) x; return; }
 
 mpc_val_t *mpcf_ctor_null(void) { return NULL; }
-mpc_val_t *mpcf_ctor_str(void) { return calloc(1, 1); }
-mpc_val_t *mpcf_free(mpc_val_t *x) { free(x); return NULL; }
+mpc_val_t *mpcf_ctor_str(void) { return mpc_calloc(1, 1); }
+mpc_val_t *mpcf_free(mpc_val_t *x) { mpc_free(x); return NULL; }
 
 mpc_val_t *mpcf_int(mpc_val_t *x) {
-  int *y = malloc(sizeof(int));
+  int *y = mpc_malloc(sizeof(int));
   *y = strtol(x, NULL, 10);
-  free(x);
+  mpc_free(x);
   return y;
 }
 
 mpc_val_t *mpcf_hex(mpc_val_t *x) {
-  int *y = malloc(sizeof(int));
+  int *y = mpc_malloc(sizeof(int));
   *y = strtol(x, NULL, 16);
-  free(x);
+  mpc_free(x);
   return y;
 }
 
 mpc_val_t *mpcf_oct(mpc_val_t *x) {
-  int *y = malloc(sizeof(int));
+  int *y = mpc_malloc(sizeof(int));
   *y = strtol(x, NULL, 8);
-  free(x);
+  mpc_free(x);
   return y;
 }
 
 mpc_val_t *mpcf_float(mpc_val_t *x) {
-  float *y = malloc(sizeof(float));
+  float *y = mpc_malloc(sizeof(float));
   *y = strtod(x, NULL);
-  free(x);
+  mpc_free(x);
   return y;
 }
 
@@ -2145,7 +3021,7 @@ static mpc_val_t *mpcf_escape_new(mpc_val_t *x, const char *input, const char **
   int found;
   char buff[2];
   char *s = x;
-  char *y = calloc(1, 1);
+  char *y = mpc_calloc(1, 1);
   
   while (*s) {
     
@@ -2154,7 +3030,7 @@ static mpc_val_t *mpcf_escape_new(mpc_val_t *x, const char *input, const char **
 
     while (output[i]) {
       if (*s == input[i]) {
-        y = realloc(y, strlen(y) + strlen(output[i]) + 1);
+        y = mpc_realloc(y, strlen(y) + strlen(output[i]) + 1);
         strcat(y, output[i]);
         found = 1;
         break;
@@ -2163,7 +3039,7 @@ static mpc_val_t *mpcf_escape_new(mpc_val_t *x, const char *input, const char **
     }
     
     if (!found) {
-      y = realloc(y, strlen(y) + 2);
+      y = mpc_realloc(y, strlen(y) + 2);
       buff[0] = *s; buff[1] = '\0';
       strcat(y, buff);
     }
@@ -2181,7 +3057,7 @@ static mpc_val_t *mpcf_unescape_new(mpc_val_t *x, const char *input, const char
   int found = 0;
   char buff[2];
   char *s = x;
-  char *y = calloc(1, 1);
+  char *y = mpc_calloc(1, 1);
   
   while (*s) {
     
@@ -2191,7 +3067,7 @@ static mpc_val_t *mpcf_unescape_new(mpc_val_t *x, const char *input, const char
     while (output[i]) {
       if ((*(s+0)) == output[i][0] &&
           (*(s+1)) == output[i][1]) {
-        y = realloc(y, strlen(y) + 2);
+        y = mpc_realloc(y, strlen(y) + 2);
         buff[0] = input[i]; buff[1] = '\0';
         strcat(y, buff);
         found = 1;
@@ -2202,7 +3078,7 @@ static mpc_val_t *mpcf_unescape_new(mpc_val_t *x, const char *input, const char
     }
     
     if (!found) {
-      y = realloc(y, strlen(y) + 2);
+      y = mpc_realloc(y, strlen(y) + 2);
       buff[0] = *s; buff[1] = '\0';
       strcat(y, buff);
     }
@@ -2217,49 +3093,49 @@ static mpc_val_t *mpcf_unescape_new(mpc_val_t *x, const char *input, const char
 
 mpc_val_t *mpcf_escape(mpc_val_t *x) {
   mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_c, mpc_escape_output_c);
-  free(x);
+  mpc_free(x);
   return y;
 }
 
 mpc_val_t *mpcf_unescape(mpc_val_t *x) {
   mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_c, mpc_escape_output_c);
-  free(x);
+  mpc_free(x);
   return y;
 }
 
 mpc_val_t *mpcf_escape_regex(mpc_val_t *x) {
   mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_re, mpc_escape_output_raw_re);
-  free(x);
+  mpc_free(x);
   return y;  
 }
 
 mpc_val_t *mpcf_unescape_regex(mpc_val_t *x) {
   mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_re, mpc_escape_output_raw_re);
-  free(x);
+  mpc_free(x);
   return y;  
 }
 
 mpc_val_t *mpcf_escape_string_raw(mpc_val_t *x) {
   mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_cstr, mpc_escape_output_raw_cstr);
-  free(x);
+  mpc_free(x);
   return y;
 }
 
 mpc_val_t *mpcf_unescape_string_raw(mpc_val_t *x) {
   mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_cstr, mpc_escape_output_raw_cstr);
-  free(x);
+  mpc_free(x);
   return y;
 }
 
 mpc_val_t *mpcf_escape_char_raw(mpc_val_t *x) {
   mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_cchar, mpc_escape_output_raw_cchar);
-  free(x);
+  mpc_free(x);
   return y;
 }
 
 mpc_val_t *mpcf_unescape_char_raw(mpc_val_t *x) {
   mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_cchar, mpc_escape_output_raw_cchar);
-  free(x);
+  mpc_free(x);
   return y;
 }
 
@@ -2271,7 +3147,7 @@ mpc_val_t *mpcf_trd(int n, mpc_val_t **xs) { (void) n; return xs[2]; }
 static mpc_val_t *mpcf_nth_free(int n, mpc_val_t **xs, int x) {
   int i;
   for (i = 0; i < n; i++) {
-    if (i != x) { free(xs[i]); }
+    if (i != x) { mpc_free(xs[i]); }
   }
   return xs[x];
 }
@@ -2282,12 +3158,12 @@ mpc_val_t *mpcf_trd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 2)
 
 mpc_val_t *mpcf_strfold(int n, mpc_val_t **xs) {
   int i;
-  char *x = calloc(1, 1);
+  char *x = mpc_calloc(1, 1);
 
   for (i = 0; i < n; i++) {
-    x = realloc(x, strlen(x) + strlen(xs[i]) + 1);
+    x = mpc_realloc(x, strlen(x) + strlen(xs[i]) + 1);
     strcat(x, xs[i]);
-    free(xs[i]);
+    mpc_free(xs[i]);
   }
   return x;
 }
@@ -2302,7 +3178,7 @@ mpc_val_t *mpcf_maths(int n, mpc_val_t **xs) {
   if (strcmp(xs[1], "+") == 0) { *vs[0] += *vs[2]; }
   if (strcmp(xs[1], "-") == 0) { *vs[0] -= *vs[2]; }
   
-  free(xs[1]); free(xs[2]);
+  mpc_free(xs[1]); mpc_free(xs[2]);
   
   return xs[0];
 }
@@ -2346,7 +3222,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("'%s'", s);
-    free(s);
+    mpc_free(s);
   }
   
   if (p->type == MPC_TYPE_RANGE) {
@@ -2361,8 +3237,8 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[%s-%s]", s, e);
-    free(s);
-    free(e);
+    mpc_free(s);
+    mpc_free(e);
   }
   
   if (p->type == MPC_TYPE_ONEOF) {
@@ -2371,7 +3247,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[%s]", s);
-    free(s);
+    mpc_free(s);
   }
   
   if (p->type == MPC_TYPE_NONEOF) {
@@ -2380,7 +3256,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[^%s]", s);
-    free(s);
+    mpc_free(s);
   }
   
   if (p->type == MPC_TYPE_STRING) {
@@ -2389,12 +3265,13 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("\"%s\"", s);
-    free(s);
+    mpc_free(s);
   }
   
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_LEAF)     { mpc_print_unretained(p->data.leaf.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2403,6 +3280,8 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_MANY1) { mpc_print_unretained(p->data.repeat.x, 0); printf("+"); }
   if (p->type == MPC_TYPE_COUNT) { mpc_print_unretained(p->data.repeat.x, 0); printf("{%i}", p->data.repeat.n); }
   
+  if (p->type == MPC_TYPE_REGEX) { mpc_print_unretained(p->data.regex.x->x, 0); }
+  
   if (p->type == MPC_TYPE_OR) {
     printf("(");
     for(i = 0; i < p->data.or.n-1; i++) {
@@ -2497,51 +3376,289 @@ int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
 
 
 /*
-** AST
+** Tags
+**
+** Every distinct tag stack a node can carry is made once and shared,
+** with its string form `outer|...|inner` and the set of ids in it built
+** when it is made. A stack of one tag is the entry for that name, found
+** by hashing the name, and the stacks pushed onto a stack hang off it,
+** so tagging a node is a short walk and never copies a string.
 */
 
-void mpc_ast_delete(mpc_ast_t *a) {
+#define MPC_TAG_SLOTS 64
+#define MPC_TAG_BITS (8 * (int)sizeof(unsigned long))
+
+struct mpc_tags_t {
+  int id;
+  char *name;
+  struct mpc_tags_t *inner;
+  struct mpc_tags_t *above;
+  struct mpc_tags_t *next;
+  unsigned long *ids;
+  int ids_num;
+};
+
+static char mpc_tags_empty[1] = "";
+
+/* The root tag is always id 0, so roots are tagged without a lookup */
+static char mpc_tag_root_name[2] = ">";
+static unsigned long mpc_tag_root_ids[1] = { 1 };
+static mpc_tags_t mpc_tag_root = { 0, mpc_tag_root_name, NULL, NULL, NULL, mpc_tag_root_ids, 1 };
+
+/* Tags by id, and hashed by name */
+static mpc_tags_t **mpc_tag_names = NULL;
+static int mpc_tag_names_num = 0;
+static int mpc_tag_names_max = 0;
+static mpc_tags_t **mpc_tag_slots = NULL;
+static int mpc_tag_slots_num = 0;
+
+static unsigned long mpc_tag_hash(const char *name, size_t len) {
+  unsigned long h = 2166136261ul;
+  size_t k;
+  for (k = 0; k < len; k++) { h = (h ^ (unsigned char)name[k]) * 16777619ul; }
+  return h;
+}
+
+/* Tags outlive any arena */
+static mpc_tags_t *mpc_tags_new(int id, const char *name, size_t len, mpc_tags_t *inner) {
   
-  int i;
+  mpc_tags_t *t = malloc(sizeof(mpc_tags_t));
+  size_t n = inner ? strlen(inner->name) : 0;
+  int w = id / MPC_TAG_BITS;
+  
+  t->id = id;
+  t->name = malloc(len + 1 + n + 1);
+  memcpy(t->name, name, len);
+  if (inner) {
+    t->name[len] = '|';
+    memcpy(t->name + len + 1, inner->name, n + 1);
+  } else {
+    t->name[len] = '\0';
+  }
   
-  if (a == NULL) { return; }
+  t->inner = inner;
+  t->above = NULL;
+  t->next = NULL;
   
-  for (i = 0; i < a->children_num; i++) {
-    mpc_ast_delete(a->children[i]);
+  t->ids_num = inner && inner->ids_num > w ? inner->ids_num : w + 1;
+  t->ids = calloc(t->ids_num, sizeof(unsigned long));
+  if (inner) { memcpy(t->ids, inner->ids, inner->ids_num * sizeof(unsigned long)); }
+  t->ids[w] |= 1ul << (id % MPC_TAG_BITS);
+  return t;
+}
+
+static void mpc_tag_rehash(void) {
+  
+  int i, n = mpc_tag_slots_num ? mpc_tag_slots_num * 2 : MPC_TAG_SLOTS;
+  mpc_tags_t **slots = calloc(n, sizeof(mpc_tags_t*));
+  mpc_tags_t *t;
+  unsigned long h;
+  
+  for (i = 0; i < mpc_tag_names_num; i++) {
+    t = mpc_tag_names[i];
+    h = mpc_tag_hash(t->name, strlen(t->name)) & (n - 1);
+    t->next = slots[h];
+    slots[h] = t;
   }
   
-  free(a->children);
-  free(a->tag);
-  free(a->contents);
-  free(a);
+  free(mpc_tag_slots);
+  mpc_tag_slots = slots;
+  mpc_tag_slots_num = n;
+}
+
+static void mpc_tag_add(mpc_tags_t *t) {
+  
+  unsigned long h;
+  
+  if (mpc_tag_names_num == mpc_tag_names_max) {
+    mpc_tag_names_max = mpc_tag_names_max ? mpc_tag_names_max * 2 : MPC_TAG_SLOTS;
+    mpc_tag_names = realloc(mpc_tag_names, sizeof(mpc_tags_t*) * mpc_tag_names_max);
+  }
+  mpc_tag_names[mpc_tag_names_num++] = t;
+  
+  if (mpc_tag_names_num > mpc_tag_slots_num) {
+    mpc_tag_rehash();
+  } else {
+    h = mpc_tag_hash(t->name, strlen(t->name)) & (mpc_tag_slots_num - 1);
+    t->next = mpc_tag_slots[h];
+    mpc_tag_slots[h] = t;
+  }
+  
+}
+
+static mpc_tags_t *mpc_tag_intern(const char *name, size_t len) {
+  
+  mpc_tags_t *t;
+  unsigned long h = mpc_tag_hash(name, len);
+  
+  if (mpc_tag_names_num == 0) { mpc_tag_add(&mpc_tag_root); }
+  
+  for (t = mpc_tag_slots[h & (mpc_tag_slots_num - 1)]; t != NULL; t = t->next) {
+    if (strncmp(t->name, name, len) == 0 && t->name[len] == '\0') { break; }
+  }
+  
+  if (t == NULL) {
+    t = mpc_tags_new(mpc_tag_names_num, name, len, NULL);
+    mpc_tag_add(t);
+  }
+  
+  return t;
   
 }
 
+/* The tag of id, NULL if there is none */
+static mpc_tags_t *mpc_tag_find(int id) {
+  if (id == 0) { return &mpc_tag_root; }
+  if (id < 0 || id >= mpc_tag_names_num) { return NULL; }
+  return mpc_tag_names[id];
+}
+
+/* The stack of the tag of tag on top of inner */
+static mpc_tags_t *mpc_tags_push(mpc_tags_t *inner, mpc_tags_t *tag) {
+  
+  mpc_tags_t *t;
+  
+  if (inner == NULL) { return tag; }
+  
+  for (t = inner->above; t != NULL; t = t->next) {
+    if (t->id == tag->id) { return t; }
+  }
+  
+  t = mpc_tags_new(tag->id, tag->name, strlen(tag->name), inner);
+  t->next = inner->above;
+  inner->above = t;
+  return t;
+  
+}
+
+int mpc_tag_id(const char *name) {
+  return mpc_tag_intern(name, strlen(name))->id;
+}
+
+const char *mpc_tag_name(int id) {
+  mpc_tags_t *t = mpc_tag_find(id);
+  return t ? t->name : NULL;
+}
+
+/*
+** AST
+*/
+
 static void mpc_ast_delete_no_children(mpc_ast_t *a) {
-  free(a->children);
-  free(a->tag);
-  free(a->contents);
-  free(a);
+  mpc_free(a->children);
+  mpc_free(a->contents);
+  mpc_free(a);
+}
+
+/* Nodes waiting to be freed are kept on a stack of its own, so deep
+   trees take no C stack */
+void mpc_ast_delete(mpc_ast_t *a) {
+  
+  int i;
+  int stack_num = 0, stack_max = 0;
+  mpc_ast_t **stack = NULL;
+  
+  while (a != NULL) {
+    
+    for (i = 0; i < a->children_num; i++) {
+      if (a->children[i] == NULL) { continue; }
+      if (stack_num == stack_max) {
+        stack_max = stack_max ? stack_max * 2 : 32;
+        stack = realloc(stack, sizeof(mpc_ast_t*) * stack_max);
+      }
+      stack[stack_num++] = a->children[i];
+    }
+    
+    mpc_ast_delete_no_children(a);
+    a = stack_num ? stack[--stack_num] : NULL;
+  }
+  
+  free(stack);
+  
 }
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
   
-  mpc_ast_t *a = malloc(sizeof(mpc_ast_t));
+  mpc_ast_t *a = mpc_malloc(sizeof(mpc_ast_t));
   
-  a->tag = malloc(strlen(tag) + 1);
-  strcpy(a->tag, tag);
+  a->tag = mpc_tags_empty;
+  a->tags = NULL;
+  mpc_ast_add_tag(a, tag);
   
-  a->contents = malloc(strlen(contents) + 1);
+  a->contents = mpc_malloc(strlen(contents) + 1);
   strcpy(a->contents, contents);
   
   a->state = mpc_state_new();
   
   a->children_num = 0;
   a->children = NULL;
+  
+  a->input = NULL;
+  a->offset = 0;
+  a->length = 0;
+  return a;
+  
+}
+
+/* A leaf for what the input consumed since s, c if it is not sliced */
+static mpc_ast_t *mpc_ast_leaf(mpc_input_t *i, mpc_state_t s, char *c) {
+  
+  mpc_ast_t *a = mpc_malloc(sizeof(mpc_ast_t));
+  
+  a->tag = mpc_tags_empty;
+  a->tags = NULL;
+  a->state = s;
+  a->children_num = 0;
+  a->children = NULL;
+  
+  if (i->slices) {
+    a->contents = NULL;
+    a->input = i->slices;
+    a->offset = s.pos;
+    a->length = i->state.pos - s.pos;
+  } else {
+    a->contents = c ? c : mpc_calloc(1, 1);
+    a->input = NULL;
+    a->offset = 0;
+    a->length = 0;
+  }
+  
   return a;
   
 }
 
+const char *mpc_ast_contents_ptr(mpc_ast_t *a) {
+  return a->contents ? a->contents : a->input + a->offset;
+}
+
+long mpc_ast_contents_len(mpc_ast_t *a) {
+  return a->input ? a->length : (long)strlen(a->contents);
+}
+
+char *mpc_ast_contents(mpc_ast_t *a) {
+  if (a->contents == NULL) {
+    a->contents = mpc_malloc(a->length + 1);
+    memcpy(a->contents, a->input + a->offset, a->length);
+    a->contents[a->length] = '\0';
+  }
+  return a->contents;
+}
+
+char *mpc_ast_contents_cpy(mpc_ast_t *a, char *buf, long n) {
+  long l = mpc_ast_contents_len(a);
+  if (l >= n) { return NULL; }
+  memcpy(buf, mpc_ast_contents_ptr(a), l);
+  buf[l] = '\0';
+  return buf;
+}
+
+static mpc_ast_t *mpc_ast_new_root(void) {
+  mpc_ast_t *a = mpc_ast_new("", "");
+  a->tags = &mpc_tag_root;
+  a->tag = mpc_tag_root.name;
+  return a;
+}
+
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
   
   mpc_ast_t *a = mpc_ast_new(tag, "");
@@ -2568,7 +3685,7 @@ mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a) {
   if (a->children_num == 0) { return a; }
   if (a->children_num == 1) { return a; }
 
-  r = mpc_ast_new(">", "");
+  r = mpc_ast_new_root();
   mpc_ast_add_child(r, a);
   return r;
 }
@@ -2577,8 +3694,9 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
   
   int i;
 
-  if (strcmp(a->tag, b->tag) != 0) { return 0; }
-  if (strcmp(a->contents, b->contents) != 0) { return 0; }
+  if (a->tags != b->tags) { return 0; }
+  if (mpc_ast_contents_len(a) != mpc_ast_contents_len(b)) { return 0; }
+  if (memcmp(mpc_ast_contents_ptr(a), mpc_ast_contents_ptr(b), mpc_ast_contents_len(a)) != 0) { return 0; }
   if (a->children_num != b->children_num) { return 0; }
   
   for (i = 0; i < a->children_num; i++) {
@@ -2590,24 +3708,64 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
 
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
   r->children_num++;
-  r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
+  r->children = mpc_realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
   r->children[r->children_num-1] = a;
   return r;
 }
 
+static mpc_ast_t *mpc_ast_add_tags(mpc_ast_t *a, mpc_tags_t *tag) {
+  if (a == NULL || tag == NULL) { return a; }
+  a->tags = mpc_tags_push(a->tags, tag);
+  a->tag = a->tags->name;
+  return a;
+}
+
+mpc_ast_t *mpc_ast_add_tag_id(mpc_ast_t *a, int id) {
+  return mpc_ast_add_tags(a, mpc_tag_find(id));
+}
+
+mpc_ast_t *mpc_ast_tag_id(mpc_ast_t *a, int id) {
+  a->tags = NULL;
+  a->tag = mpc_tags_empty;
+  return mpc_ast_add_tag_id(a, id);
+}
+
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
+  
+  const char *p, *q;
+  
   if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
-  memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, strlen(t));
-  memmove(a->tag + strlen(t), "|", 1);
+  
+  /* Push "outer|inner" innermost first */
+  p = t + strlen(t);
+  while (p > t) {
+    q = p;
+    while (q > t && q[-1] != '|') { q--; }
+    if (q < p) { mpc_ast_add_tags(a, mpc_tag_intern(q, p - q)); }
+    p = q > t ? q - 1 : t;
+  }
+  
   return a;
 }
 
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
-  a->tag = realloc(a->tag, strlen(t) + 1);
-  strcpy(a->tag, t);
-  return a;
+  a->tags = NULL;
+  a->tag = mpc_tags_empty;
+  return mpc_ast_add_tag(a, t);
+}
+
+int mpc_ast_has_tag(mpc_ast_t *a, int id) {
+  mpc_tags_t *t = a->tags;
+  if (t == NULL || id < 0 || id / MPC_TAG_BITS >= t->ids_num) { return 0; }
+  return (t->ids[id / MPC_TAG_BITS] >> (id % MPC_TAG_BITS)) & 1;
+}
+
+int mpc_ast_top_tag(mpc_ast_t *a) {
+  return a->tags ? a->tags->id : -1;
+}
+
+char *mpc_ast_get_tag(mpc_ast_t *a) {
+  return a->tag;
 }
 
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
@@ -2627,13 +3785,13 @@ static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
   
   for (i = 0; i < d; i++) { fprintf(fp, "  "); }
   
-  if (strlen(a->contents)) {
-    fprintf(fp, "%s:%lu:%lu '%s'\n", a->tag, 
+  if (mpc_ast_contents_len(a)) {
+    fprintf(fp, "%s:%lu:%lu '%.*s'\n", mpc_ast_get_tag(a), 
       (long unsigned int)(a->state.row+1),
       (long unsigned int)(a->state.col+1),
-      a->contents);
+      (int)mpc_ast_contents_len(a), mpc_ast_contents_ptr(a));
   } else {
-    fprintf(fp, "%s \n", a->tag);
+    fprintf(fp, "%s \n", mpc_ast_get_tag(a));
   }
   
   for (i = 0; i < a->children_num; i++) {
@@ -2661,7 +3819,7 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
   if (n == 2 && xs[1] == NULL) { return xs[0]; }
   if (n == 2 && xs[0] == NULL) { return xs[1]; }
   
-  r = mpc_ast_new(">", "");
+  r = mpc_ast_new_root();
   
   for (i = 0; i < n; i++) {
     
@@ -2690,7 +3848,7 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
 
 mpc_val_t *mpcf_str_ast(mpc_val_t *c) {
   mpc_ast_t *a = mpc_ast_new("", c);
-  free(c);
+  mpc_free(c);
   return a;
 }
 
@@ -2698,21 +3856,40 @@ mpc_val_t *mpcf_state_ast(int n, mpc_val_t **xs) {
   mpc_state_t *s = ((mpc_state_t**)xs)[0];
   mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
   a = mpc_ast_state(a, *s);
-  free(s);
+  mpc_free(s);
   (void) n;
   return a;
 }
 
 mpc_parser_t *mpca_state(mpc_parser_t *a) {
-  return mpc_and(2, mpcf_state_ast, mpc_state(), a, free);
+  return mpc_and(2, mpcf_state_ast, mpc_state(), a, mpc_free);
+}
+
+mpc_parser_t *mpca_leaf(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_LEAF;
+  p->data.leaf.x = a;
+  return p;
+}
+
+static mpc_val_t *mpcf_tag_ast(mpc_val_t *a, void *t) {
+  mpc_ast_t *b = a;
+  if (b == NULL) { return b; }
+  b->tags = t;
+  b->tag = b->tags->name;
+  return b;
+}
+
+static mpc_val_t *mpcf_add_tag_ast(mpc_val_t *a, void *t) {
+  return mpc_ast_add_tags(a, t);
 }
 
 mpc_parser_t *mpca_tag(mpc_parser_t *a, const char *t) {
-  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_tag, (void*)t);
+  return mpc_apply_to(a, mpcf_tag_ast, mpc_tag_intern(t, strlen(t)));
 }
 
 mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t) {
-  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_tag, (void*)t);
+  return mpc_apply_to(a, mpcf_add_tag_ast, mpc_tag_intern(t, strlen(t)));
 }
 
 mpc_parser_t *mpca_root(mpc_parser_t *a) {
@@ -2734,7 +3911,7 @@ mpc_parser_t *mpca_or(int n, ...) {
   
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
-  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.xs = mpc_malloc(sizeof(mpc_parser_t*) * n);
   
   va_start(va, n);  
   for (i = 0; i < n; i++) {
@@ -2756,8 +3933,8 @@ mpc_parser_t *mpca_and(int n, ...) {
   p->type = MPC_TYPE_AND;
   p->data.and.n = n;
   p->data.and.f = mpcf_fold_ast;
-  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
-  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n-1));
+  p->data.and.xs = mpc_malloc(sizeof(mpc_parser_t*) * n);
+  p->data.and.dxs = mpc_malloc(sizeof(mpc_dtor_t) * (n-1));
   
   va_start(va, n);
   for (i = 0; i < n; i++) {
@@ -2843,37 +4020,40 @@ static mpc_val_t *mpcaf_grammar_repeat(int n, mpc_val_t **xs) {
   int num;
   (void) n;
   if (xs[1] == NULL) { return xs[0]; }  
-  if (strcmp(xs[1], "*") == 0) { free(xs[1]); return mpca_many(xs[0]); }
-  if (strcmp(xs[1], "+") == 0) { free(xs[1]); return mpca_many1(xs[0]); }
-  if (strcmp(xs[1], "?") == 0) { free(xs[1]); return mpca_maybe(xs[0]); }
-  if (strcmp(xs[1], "!") == 0) { free(xs[1]); return mpca_not(xs[0]); }
+  if (strcmp(xs[1], "*") == 0) { mpc_free(xs[1]); return mpca_many(xs[0]); }
+  if (strcmp(xs[1], "+") == 0) { mpc_free(xs[1]); return mpca_many1(xs[0]); }
+  if (strcmp(xs[1], "?") == 0) { mpc_free(xs[1]); return mpca_maybe(xs[0]); }
+  if (strcmp(xs[1], "!") == 0) { mpc_free(xs[1]); return mpca_not(xs[0]); }
   num = *((int*)xs[1]);
-  free(xs[1]);
+  mpc_free(xs[1]);
   return mpca_count(num, xs[0]);
 }
 
 static mpc_val_t *mpcaf_grammar_string(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_string(y) : mpc_tok(mpc_string(y));
-  free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "string"));
+  mpc_parser_t *p = mpca_leaf(mpc_string(y));
+  mpc_free(y);
+  if (!(st->flags & MPCA_LANG_WHITESPACE_SENSITIVE)) { p = mpc_tok(p); }
+  return mpca_tag(p, "string");
 }
 
 static mpc_val_t *mpcaf_grammar_char(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_char(y[0]) : mpc_tok(mpc_char(y[0]));
-  free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "char"));
+  mpc_parser_t *p = mpca_leaf(mpc_char(y[0]));
+  mpc_free(y);
+  if (!(st->flags & MPCA_LANG_WHITESPACE_SENSITIVE)) { p = mpc_tok(p); }
+  return mpca_tag(p, "char");
 }
 
 static mpc_val_t *mpcaf_grammar_regex(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape_regex(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_re(y) : mpc_tok(mpc_re(y));
-  free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "regex"));
+  mpc_parser_t *p = mpca_leaf(mpc_re(y));
+  mpc_free(y);
+  if (!(st->flags & MPCA_LANG_WHITESPACE_SENSITIVE)) { p = mpc_tok(p); }
+  return mpca_tag(p, "regex");
 }
 
 /* Should this just use `isdigit` instead? */
@@ -2895,7 +4075,7 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
     
     while (st->parsers_num <= i) {
       st->parsers_num++;
-      st->parsers = realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
+      st->parsers = mpc_realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
       st->parsers[st->parsers_num-1] = va_arg(*st->va, mpc_parser_t*);
       if (st->parsers[st->parsers_num-1] == NULL) {
         return mpc_failf("No Parser in position %i! Only supplied %i Parsers!", i, st->parsers_num);
@@ -2920,7 +4100,7 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
       p = va_arg(*st->va, mpc_parser_t*);
       
       st->parsers_num++;
-      st->parsers = realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
+      st->parsers = mpc_realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
       st->parsers[st->parsers_num-1] = p;
       
       if (p == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
@@ -2936,7 +4116,7 @@ static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
   
   mpca_grammar_st_t *st = s;
   mpc_parser_t *p = mpca_grammar_find_parser(x, st);
-  free(x);
+  mpc_free(x);
 
   if (p->name) {
     return mpca_state(mpca_root(mpca_add_tag(p, p->name)));
@@ -2964,7 +4144,7 @@ mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
   
   mpc_define(Grammar, mpc_and(2, mpcaf_grammar_or,
     Term,
-    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_sym("|"), Grammar, free)),
+    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_sym("|"), Grammar, mpc_free)),
     mpc_soft_delete
   ));
   
@@ -2977,7 +4157,7 @@ mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
         mpc_sym("+"),
         mpc_sym("?"),
         mpc_sym("!"),
-        mpc_tok_brackets(mpc_int(), free),
+        mpc_tok_brackets(mpc_int(), mpc_free),
         mpc_pass()),
     mpc_soft_delete
   ));
@@ -2986,7 +4166,7 @@ mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
     mpc_apply_to(mpc_tok(mpc_string_lit()), mpcaf_grammar_string, st),
     mpc_apply_to(mpc_tok(mpc_char_lit()),   mpcaf_grammar_char, st),
     mpc_apply_to(mpc_tok(mpc_regex_lit()),  mpcaf_grammar_regex, st),
-    mpc_apply_to(mpc_tok_braces(mpc_or(2, mpc_digits(), mpc_ident()), free), mpcaf_grammar_id, st),
+    mpc_apply_to(mpc_tok_braces(mpc_or(2, mpc_digits(), mpc_ident()), mpc_free), mpcaf_grammar_id, st),
     mpc_tok_parens(Grammar, mpc_soft_delete)
   ));
   
@@ -2994,7 +4174,7 @@ mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
     err_msg = mpc_err_string(r.error);
     err_out = mpc_failf("Invalid Grammar: %s", err_msg);
     mpc_err_delete(r.error);
-    free(err_msg);
+    mpc_free(err_msg);
     r.output = err_out;
   }
   
@@ -3016,7 +4196,7 @@ mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...) {
   st.flags = flags;
   
   res = mpca_grammar_st(grammar, &st);  
-  free(st.parsers);
+  mpc_free(st.parsers);
   va_end(va);
   return res;
 }
@@ -3028,13 +4208,13 @@ typedef struct {
 } mpca_stmt_t;
 
 static mpc_val_t *mpca_stmt_afold(int n, mpc_val_t **xs) {
-  mpca_stmt_t *stmt = malloc(sizeof(mpca_stmt_t));
+  mpca_stmt_t *stmt = mpc_malloc(sizeof(mpca_stmt_t));
   stmt->ident = ((char**)xs)[0];
   stmt->name = ((char**)xs)[1];
   stmt->grammar = ((mpc_parser_t**)xs)[3];
   (void) n;
-  free(((char**)xs)[2]);
-  free(((char**)xs)[4]);
+  mpc_free(((char**)xs)[2]);
+  mpc_free(((char**)xs)[4]);
   
   return stmt;
 }
@@ -3042,7 +4222,7 @@ static mpc_val_t *mpca_stmt_afold(int n, mpc_val_t **xs) {
 static mpc_val_t *mpca_stmt_fold(int n, mpc_val_t **xs) {
   
   int i;
-  mpca_stmt_t **stmts = malloc(sizeof(mpca_stmt_t*) * (n+1));
+  mpca_stmt_t **stmts = mpc_malloc(sizeof(mpca_stmt_t*) * (n+1));
   
   for (i = 0; i < n; i++) {
     stmts[i] = xs[i];
@@ -3058,13 +4238,13 @@ static void mpca_stmt_list_delete(mpc_val_t *x) {
 
   while(*stmts) {
     mpca_stmt_t *stmt = *stmts; 
-    free(stmt->ident);
-    free(stmt->name);
+    mpc_free(stmt->ident);
+    mpc_free(stmt->name);
     mpc_soft_delete(stmt->grammar);
-    free(stmt);  
+    mpc_free(stmt);  
     stmts++;
   }
-  free(x);
+  mpc_free(x);
 
 }
 
@@ -3081,12 +4261,12 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
     mpc_define(left, stmt->grammar);
-    free(stmt->ident);
-    free(stmt->name);
-    free(stmt);
+    mpc_free(stmt->ident);
+    mpc_free(stmt->name);
+    mpc_free(stmt);
     stmts++;
   }
-  free(x);
+  mpc_free(x);
   
   return NULL;
 }
@@ -3111,12 +4291,12 @@ static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st) {
   
   mpc_define(Stmt, mpc_and(5, mpca_stmt_afold,
     mpc_tok(mpc_ident()), mpc_maybe(mpc_tok(mpc_string_lit())), mpc_sym(":"), Grammar, mpc_sym(";"),
-    free, free, free, mpc_soft_delete
+    mpc_free, mpc_free, mpc_free, mpc_soft_delete
   ));
   
   mpc_define(Grammar, mpc_and(2, mpcaf_grammar_or,
       Term,
-      mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_sym("|"), Grammar, free)),
+      mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_sym("|"), Grammar, mpc_free)),
       mpc_soft_delete
   ));
   
@@ -3129,7 +4309,7 @@ static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st) {
         mpc_sym("+"),
         mpc_sym("?"),
         mpc_sym("!"),
-        mpc_tok_brackets(mpc_int(), free),
+        mpc_tok_brackets(mpc_int(), mpc_free),
         mpc_pass()),
     mpc_soft_delete
   ));
@@ -3138,7 +4318,7 @@ static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st) {
     mpc_apply_to(mpc_tok(mpc_string_lit()), mpcaf_grammar_string, st),
     mpc_apply_to(mpc_tok(mpc_char_lit()),   mpcaf_grammar_char, st),
     mpc_apply_to(mpc_tok(mpc_regex_lit()),  mpcaf_grammar_regex, st),
-    mpc_apply_to(mpc_tok_braces(mpc_or(2, mpc_digits(), mpc_ident()), free), mpcaf_grammar_id, st),
+    mpc_apply_to(mpc_tok_braces(mpc_or(2, mpc_digits(), mpc_ident()), mpc_free), mpcaf_grammar_id, st),
     mpc_tok_parens(Grammar, mpc_soft_delete)
   ));
   
@@ -3171,7 +4351,7 @@ mpc_err_t *mpca_lang_file(int flags, FILE *f, ...) {
   err = mpca_lang_st(i, &st);
   mpc_input_delete(i);
   
-  free(st.parsers);
+  mpc_free(st.parsers);
   va_end(va);
   return err;
 }
@@ -3193,7 +4373,7 @@ mpc_err_t *mpca_lang_pipe(int flags, FILE *p, ...) {
   err = mpca_lang_st(i, &st);
   mpc_input_delete(i);
   
-  free(st.parsers);
+  mpc_free(st.parsers);
   va_end(va);
   return err;
 }
@@ -3216,7 +4396,7 @@ mpc_err_t *mpca_lang(int flags, const char *language, ...) {
   err = mpca_lang_st(i, &st);
   mpc_input_delete(i);
   
-  free(st.parsers);
+  mpc_free(st.parsers);
   va_end(va);
   return err;
 }
@@ -3246,7 +4426,7 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   err = mpca_lang_st(i, &st);
   mpc_input_delete(i);
   
-  free(st.parsers);
+  mpc_free(st.parsers);
   va_end(va);  
   
   fclose(f);
@@ -60,10 +60,31 @@ typedef union {
 struct mpc_parser_t;
 typedef struct mpc_parser_t mpc_parser_t;
 
+/*
+** Arena
+**
+** Between `mpc_arena_begin` and `mpc_arena_end` all of mpc's allocations,
+** parse results and errors included, come from the arena. Deleting them
+** does nothing, and `mpc_arena_end` drops the lot at once, so results
+** must not be used past it. Parsers should be built outside an arena,
+** and callbacks that free or realloc values with the C library, like
+** `free` passed as a destructor, cannot run inside one.
+*/
+
+typedef struct mpc_arena_t mpc_arena_t;
+
+mpc_arena_t *mpc_arena_new(void);
+void mpc_arena_delete(mpc_arena_t *a);
+void mpc_arena_begin(mpc_arena_t *a);
+void mpc_arena_end(mpc_arena_t *a);
+long mpc_arena_allocs(mpc_arena_t *a);
+long mpc_arena_bytes(mpc_arena_t *a);
+
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
+int mpc_parse_slices(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
 
 /*
 ** Function Types
@@ -247,6 +268,13 @@ mpc_val_t *mpcf_maths(int n, mpc_val_t** xs);
 
 /*
 ** Regular Expression Parsers
+**
+** Regexes that need no lookaround are matched by a DFA compiled once per
+** distinct regex string. A DFA only reports where a match ends, so when
+** a parse using one fails it is run again without them for the error.
+** That second run only builds the error: it calls no apply, fold, lift
+** or destructor, so those run once per parse. `mpc_satisfy` predicates
+** decide what matches and are called in both runs.
 */
 
 mpc_parser_t *mpc_re(const char *re);
@@ -255,12 +283,38 @@ mpc_parser_t *mpc_re(const char *re);
 ** AST
 */
 
+/*
+** Tags are interned into small integer ids, rule names when `mpca_lang`
+** builds the grammar. A node's tags are a shared, interned stack, any
+** number deep, that `mpc_ast_has_tag` looks through. `tag` always holds
+** its string form `outer|...|inner`, but the string belongs to the
+** stack: it is shared between nodes and must not be changed or freed.
+*/
+
+typedef struct mpc_tags_t mpc_tags_t;
+
+int mpc_tag_id(const char *name);
+const char *mpc_tag_name(int id);
+
+/*
+** With `mpc_parse_slices` the contents of leaves are not copied out of
+** the input. Leaves made by `mpca_leaf`, as the grammar makes its
+** strings, chars and regexes, are left as `length` bytes at `offset`
+** into `input`, with `contents` NULL until `mpc_ast_contents` is called,
+** so the input string must outlive the AST. Use the accessors when
+** either may apply.
+*/
+
 typedef struct mpc_ast_t {
   char *tag;
   char *contents;
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  const char *input;
+  long offset;
+  long length;
+  mpc_tags_t *tags;
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
@@ -271,6 +325,17 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s);
 
+mpc_ast_t *mpc_ast_add_tag_id(mpc_ast_t *a, int id);
+mpc_ast_t *mpc_ast_tag_id(mpc_ast_t *a, int id);
+int mpc_ast_has_tag(mpc_ast_t *a, int id);
+int mpc_ast_top_tag(mpc_ast_t *a);
+char *mpc_ast_get_tag(mpc_ast_t *a);
+
+const char *mpc_ast_contents_ptr(mpc_ast_t *a);
+long mpc_ast_contents_len(mpc_ast_t *a);
+char *mpc_ast_contents(mpc_ast_t *a);
+char *mpc_ast_contents_cpy(mpc_ast_t *a, char *buf, long n);
+
 void mpc_ast_delete(mpc_ast_t *a);
 void mpc_ast_print(mpc_ast_t *a);
 void mpc_ast_print_to(mpc_ast_t *a, FILE *fp);
@@ -288,6 +353,7 @@ mpc_parser_t *mpca_tag(mpc_parser_t *a, const char *t);
 mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t);
 mpc_parser_t *mpca_root(mpc_parser_t *a);
 mpc_parser_t *mpca_state(mpc_parser_t *a);
+mpc_parser_t *mpca_leaf(mpc_parser_t *a);
 mpc_parser_t *mpca_total(mpc_parser_t *a);
 
 mpc_parser_t *mpca_not(mpc_parser_t *a);
@@ -1,11 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
 
 #include "mpc.h"
 
 /* Win support */
 #ifdef _WIN32
-#include <string.h>
 
 static char buffer[2048];
 
@@ -33,520 +37,4404 @@ void add_history (char *unused) {}
 // Empty struct typedefs to avoid cyclic types issues
 struct lval;
 struct lenv;
+struct lbig;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lbig lbig;
 
 /* lval Types */
-enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
+enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR,
+       LVAL_DBL, LVAL_VEC, LVAL_RRB, LVAL_CONS };
+
+/* Q-Expressions are arrays and trees by default, build with -DLEZ_CONS=1
+   to keep them as cons lists instead */
+#ifndef LEZ_CONS
+#define LEZ_CONS 0
+#endif
 
 /// Implement the forwarded typeddefs
 typedef lval* (*lbuiltin)(lenv*, lval*);
 
-/*  */
-struct lenv {
-  int count;
-  char **syms;
-  lval **vals;
-};
+/* Type masks for builtin arguments */
+#define LTYPE(t)   (1 << (t))
+#define LTYPE_ANY  (~0)
+#define LTYPE_NUMBER (LTYPE(LVAL_NUM) | LTYPE(LVAL_DBL))
+#define LTYPE_LIST   (LTYPE(LVAL_QEXPR) | LTYPE(LVAL_VEC) | LTYPE(LVAL_RRB) \
+		      | LTYPE(LVAL_CONS))
+/* Operands of arithmetic, lists are worked on elementwise */
+#define LTYPE_OPERAND (LTYPE_NUMBER | LTYPE_LIST)
 
-/* lval */
+/* A builtin and what it accepts, checked once before the call so the
+   builtins themselves only test what depends on argument values */
+typedef struct {
+	char *name;
+	lbuiltin call;
+	int min_args;
+	int max_args;    /* -1 for no limit */
+	int arg_types;   /* LTYPE mask every argument must match */
+	int pure;        /* Result depends on the arguments alone */
+	char *type_err;  /* NULL for the generic message */
+} lbuiltin_def;
+
+/* lval
+ *
+ * What a node holds besides its header depends on its type, the payloads
+ * of the types share one union: a number or its digits, a double, a
+ * string, a builtin, or the count of a list and where its items are.
+ */
 struct lval {
 	int type;
-	long num;
-	/* Error and Symbol have string data */
-	char *err;
-	char *sym;
-	/* Count and Pointer to a list of lval */
-	int count;
-	struct lval **cell;
-} lval;
+	/* Set when the node and its cells live in the line arena */
+	int arena;
+	/* Owners sharing this node, it may only be changed in place at 1 */
+	int refs;
+	union {
+		struct {
+			long num;
+			lbig *big;    /* Digits of a number beyond a long, else NULL */
+		};
+		double dbl;   /* Doubles without an immediate form */
+		/* Error and Symbol have string data, sym is interned */
+		char *err;
+		char *sym;
+		lbuiltin_def *fun;
+		/* Items of the list types, count of them in each */
+		struct {
+			int count;
+			int front;
+			int cap;
+			/* Numbers of an LVAL_VEC are packed as longs or doubles
+			   as elem is LVAL_NUM or LVAL_DBL */
+			int elem;
+			union {
+				/* cell points at the first item, front items before
+				   it were popped, the block has cap slots */
+				struct lval **cell;
+				/* Numbers of an LVAL_VEC, count, front and cap work
+				   as for cells */
+				void *pack;
+				/* Tree of an LVAL_RRB */
+				struct lrrb *rrb;
+				/* Cells of an LVAL_CONS, the list starts at slot
+				   front of that run */
+				struct lcons *cons;
+			};
+		};
+	};
+};
 
-lenv *lenv_new(void)
-{
-  lenv *e = malloc(Single(lenv));
-  e->count = 0;
-  e->syms = NULL;
-  e->vals = NULL;
-  return e;
-}
+/* Immediate numbers
+ *
+ * Numbers that fit in a pointer minus its low bit are not allocated at all:
+ * the value is shifted left and tagged with a set low bit, so it can live
+ * directly in a cell[] slot. Heap lval structs are always at least word
+ * aligned so their low bit is never set. Only numbers outside the fixnum
+ * range fall back to a malloc'd LVAL_NUM box.
+ */
+#define LVAL_FIXNUM_MIN (INTPTR_MIN >> 1)
+#define LVAL_FIXNUM_MAX (INTPTR_MAX >> 1)
 
-void lenv_del (lenv *e)
+static inline int lval_is_fixnum (lval *v)
 {
-  for (int i = 0; i < e->count; i++)
-  {
-    free(e->syms[i]);
-    lval_del(e->vals[i]);
-  }
-  free(e->syms);
-  free(e->vals);
-  free(e);
+	return (uintptr_t) v & 1;
 }
 
-lval *lenv_get(lenv *e, lval *k)
+static inline lval *lval_fixnum (long x)
 {
-  /* Iterate over all items of environment */
-  for (int i = 0; i < e->count; i++)
-  {
-    if (strcmp(e->syms[i], k->sym) == 0)
-    {
-      return lval_copy(e->vals[i]);
-    }
-  }
-  /* If not symbol return error */
-  return lval_err("Unbound symbol!");
-}
-
-/* lval fun Type */
-lval *lval_fun(lbuiltin func) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
-  v->fun = func;
-  return v;
+	return (lval*) (((uintptr_t) x << 1) | 1);
 }
 
-/* lval Number Type */
-lval *lval_num (long x)
+static inline long lval_fixnum_value (lval *v)
 {
-	lval *v = malloc (sizeof(lval));
-	v->type = LVAL_NUM;
-	v->num = x;
-	return v;
+	return (long) ((intptr_t) v >> 1);
 }
 
-/* lval Error Type */
-lval *lval_err(char *m)
-{
-	lval *v = malloc (sizeof(lval));
-	v->type = LVAL_ERR;
-	v->err = malloc (strlen (m) + 1);
-	strcpy (v->err, m);
-	return v;
-}
+/* Immediate doubles
+ *
+ * On 64-bit targets most doubles are immediates as well, tagged 10 in the
+ * low bits. Doubles with a binary exponent in -255..256, and 0.0, keep all
+ * of their bits after rotating them left by three: the top bits of such an
+ * exponent are 011 or 100, so the two of them that rotate into the low bits
+ * follow from the third, which lands in the sign bit, and make room for
+ * the tag.
+ * The rest, -0.0, infinities, NaNs, tiny and huge values, are boxed as an
+ * LVAL_DBL.
+ */
+#if UINTPTR_MAX == 0xffffffffffffffffu
+#define LVAL_FLONUM
+#define LVAL_FLONUM_ZERO 0x8000000000000002u
+#endif
 
-/* lval Symbol */
-lval *lval_sym(char *s)
+/* Is v a fixnum or flonum rather than a heap lval */
+static inline int lval_is_immediate (lval *v)
 {
-	lval *v = malloc(sizeof(lval));
-	v->type = LVAL_SYM;
-	v->sym = malloc(strlen(s) + 1);
-	strcpy(v->sym, s);
-	return v;
+	return (uintptr_t) v & 3;
 }
 
-/* Empty lval Sexpr */
-lval *lval_sexpr(void)
+static inline int lval_is_flonum (lval *v)
 {
-	lval *v = malloc(sizeof(lval));
-	v->type = LVAL_SEXPR;
-	v->count = 0;
-	v->cell = NULL;
-	return v;
+	return ((uintptr_t) v & 3) == 2;
 }
 
-/* A pointer to new empty Qexpr lval */
-lval *lval_qexpr(void)
+/* Immediate holding x, or NULL if it needs a box */
+static inline lval *lval_flonum (double x)
 {
-	lval *v = malloc(sizeof(lval));
-	v->type = LVAL_QEXPR;
-	v->count = 0;
-	v->cell = NULL;
-	return v;
+#ifdef LVAL_FLONUM
+	uint64_t b;
+	memcpy (&b, &x, sizeof(b));
+	int top = (int) (b >> 60) & 7;
+	/* 0x3000000000000000 would land on the encoding of 0.0 */
+	if ((top == 3 || top == 4) && b != 0x3000000000000000u) {
+		b = (b << 3) | (b >> 61);
+		return (lval*) (uintptr_t) ((b & ~(uint64_t) 1) | 2);
+	}
+	if (b == 0)
+		return (lval*) (uintptr_t) LVAL_FLONUM_ZERO;
+#else
+	(void) x;
+#endif
+	return NULL;
 }
 
-void lval_del(lval *v)
+static inline double lval_flonum_value (lval *v)
 {
-	switch (v->type) {
-	case LVAL_NUM:
-		break;
-	case LVAL_ERR:
-		free (v->err);
-		break;
-	case LVAL_SYM:
-		free (v->sym);
-		break;
-	case LVAL_SEXPR:
-	case LVAL_QEXPR:
-		for (int i = 0; i < v->count; i++) {
-			lval_del (v->cell[i]);
-		}
-		free (v->cell);
-		break;
-  case LVAL_FUN:
-    break;
+	double x = 0.0;
+#ifdef LVAL_FLONUM
+	uint64_t b = (uintptr_t) v;
+	if (b != LVAL_FLONUM_ZERO) {
+		b = (2 - (b >> 63)) | (b & ~(uint64_t) 3);
+		b = (b >> 3) | (b << 61);
+		memcpy (&x, &b, sizeof(x));
 	}
-	/* Free the memory allocated for the lval struct itself */
-	free (v);
+#else
+	(void) v;
+#endif
+	return x;
 }
 
-lval *lval_add (lval *v, lval *x)
+/* Type of any lval, immediate or boxed */
+static inline int lval_type (lval *v)
 {
-	v->count++;
-	v->cell = realloc (v->cell, sizeof(lval*) * v->count);
-	v->cell[v->count - 1] = x;
-	return v;
+	if (lval_is_fixnum (v))
+		return LVAL_NUM;
+	return lval_is_flonum (v) ? LVAL_DBL : v->type;
 }
 
-lval *lval_copy (lval *v)
+/* Numeric value of an LVAL_NUM, immediate or boxed */
+static inline long lval_number (lval *v)
 {
-  lval *x = malloc(sizeof(lval));
-  x->type = v->type;
-
-  switch (v->type) {
-    /* Copy functions and number directly */
-    case LVAL_FUN:
-      x->fun = v->fun;
-      break;
-    case LVAL_NUM:
-      x->num = v->num;
-      break;
-    /*Copy strings using malloc and strcpy */
-    case LVAL_ERR:
-      x->err =malloc(strlen(v->err) + 1);
-      strcpy(x->sym, v->sym);
-      break;
-    case LVAL_SEXPR:
-    case LVAL_QEXPR:
-      x->count = v->count;
-      x->cell = malloc(sizeof(lval*) * x->count);
-      for (int i = 0; i < x->count; i++)
-      {
-        x->cell[i] == lval_copy(v->cell[i]);
-      }
-      break;
-  }
-  return x;
+	return lval_is_fixnum (v) ? lval_fixnum_value (v) : v->num;
 }
 
-lval *lval_pop (lval *v, int i)
+/* Value of an LVAL_DBL, immediate or boxed */
+static inline double lval_double (lval *v)
 {
-	/* Find the item at i */
-	lval *x = v->cell[i];
+	return lval_is_flonum (v) ? lval_flonum_value (v) : v->dbl;
+}
 
-	/*Shift memory after the item at i over the top */
-	memmove (&v->cell[i], &v->cell[i+1],
-		sizeof(lval*) * (v->count - i - 1));
+/* lval allocator
+ *
+ * lval structs come from slabs of LALLOC_SLAB nodes threaded on a free
+ * list, cell arrays from power of two size classes, each class with its
+ * own free list. Arrays bigger than the largest class go to malloc.
+ * Nothing is handed back to the system, freed blocks are reused.
+ *
+ * Optionally all allocations of one REPL line can be served from a bump
+ * arena instead (lalloc_arena_begin/end). Arena nodes are never freed one
+ * by one, the whole arena is reset in one step at the end of the line.
+ */
+#define LALLOC_SLAB    256
+#define LALLOC_CLASSES 8     /* cell classes hold 1, 2, 4, ... 128 items */
+#define LALLOC_ARENA   (64 * 1024)
 
-	/* Decrease the count of items in the list */
-	v->count--;
+typedef struct lfree { struct lfree *next; } lfree;
 
-	/* Decrease the memory used */
-	v->cell = realloc (v->cell, sizeof(lval*) * v->count);
-	return x;
-}
+typedef struct larena_chunk {
+	struct larena_chunk *next;
+	size_t used;
+	size_t size;
+} larena_chunk;
 
-lval *lval_conj (lval *x, lval *y)
-{
-	while (y->count) {
-		x = lval_add (x, lval_pop (y, 0));
-	}
-	lval_del(y);
-	return x;
-}
+/* Allocations start this far into a chunk, the header rounded up to 16
+   bytes so they keep the alignment malloc gives */
+#define LARENA_HEAD ((sizeof(larena_chunk) + 15) & ~(size_t) 15)
 
-lval *lval_take (lval *v, int i)
-{
-	lval *x = lval_pop (v, i);
-	lval_del (v);
-	return x;
-}
+struct {
+	lfree *lvals;
+	lfree *cells[LALLOC_CLASSES];
+	larena_chunk *arena;
+	int arena_on;
+} lalloc;
 
-/* Forward define functions */
-void lval_print (lval *v);
+/* Counters, printed by the REPL with --stats */
+struct {
+	unsigned long lval_allocs;
+	unsigned long lval_frees;
+	unsigned long cell_allocs;
+	unsigned long cell_frees;
+	unsigned long arena_allocs;
+	unsigned long arena_resets;
+	unsigned long sys_allocs;   /* Calls that actually reached malloc */
+} lalloc_stats;
 
-void lval_expr_print (lval *v, char open, char close)
+static void *lalloc_sys (size_t size)
 {
-	putchar (open);
-	for (int i = 0; i < v->count; i++) {
-		/* Print value contained within */
-		lval_print (v->cell[i]);
-		/* Don't print trailing space */
-		if(i != (v->count - 1)) {
-			putchar (' ');
-		}
-	}
-	putchar (close);
+	lalloc_stats.sys_allocs++;
+	return malloc (size);
 }
 
-/* Print an lval */
-void lval_print (lval *v)
+/* Bump allocate size bytes from the line arena */
+static void *larena_alloc (size_t size)
 {
-	switch (v->type) {
-	case LVAL_NUM:
-		printf ("%li", v->num);
-		break;
-	case LVAL_ERR:
-		printf ("Error: %s", v->err);
-		break;
-	case LVAL_SYM:
-		printf ("%s", v->sym);
-		break;
-	case LVAL_SEXPR:
-		lval_expr_print (v, '(', ')');
-		break;
-	case LVAL_QEXPR:
-		lval_expr_print (v, '{', '}');
-		break;
-  case LVAL_FUN:
-    printf("<function>");
-    break;
+	size = (size + 15) & ~(size_t) 15;
+	larena_chunk *c = lalloc.arena;
+	if (c == NULL || c->used + size > c->size) {
+		size_t n = size > LALLOC_ARENA ? size : LALLOC_ARENA;
+		c = lalloc_sys (LARENA_HEAD + n);
+		c->used = 0;
+		c->size = n;
+		c->next = lalloc.arena;
+		lalloc.arena = c;
 	}
+	void *p = (char*) c + LARENA_HEAD + c->used;
+	c->used += size;
+	lalloc_stats.arena_allocs++;
+	return p;
 }
 
-void lval_println (lval *v)
+void lalloc_arena_begin (void)
 {
-	lval_print (v);
-	putchar ('\n');
+	lalloc.arena_on = 1;
 }
 
-
-#define LASSERT(args, cond, err) \
-	if (!(cond)) { lval_del (args); return lval_err (err); }
-
-lval *lval_eval (lval *v);
-
-/* Return S-Expression transformed to Q-expression (builds a list) */
-lval *builtin_list (lval *a)
+/* Drop everything allocated since lalloc_arena_begin */
+void lalloc_arena_end (void)
 {
-	a->type = LVAL_QEXPR;
-	return a;
+	/* Keep the newest chunk around for the next line */
+	larena_chunk *c = lalloc.arena;
+	if (c != NULL) {
+		while (c->next) {
+			larena_chunk *n = c->next;
+			c->next = n->next;
+			free (n);
+		}
+		c->used = 0;
+	}
+	lalloc.arena_on = 0;
+	lalloc_stats.arena_resets++;
 }
 
-/* Return the head(first) element of the list CAR */
-lval *builtin_first (lval *a)
+lval *lval_alloc (void)
 {
-	LASSERT (a, a->count == 1,
-		 "Function 'first' passed too many arguments.");
-	LASSERT (a, a->cell[0]->type == LVAL_QEXPR,
-		 "Function 'first' passed incorrect type.");
-	LASSERT (a, a->cell[0]->count != 0,
-		 "Function 'first' passed {}.");
-
-	lval *v = lval_take (a, 0);
+	lval *v;
+	lalloc_stats.lval_allocs++;
 
-	while (v->count > 1) {
-		lval_del (lval_pop (v, 1));
+	if (lalloc.arena_on) {
+		v = larena_alloc (sizeof(lval));
+		v->arena = 1;
+		v->refs = 1;
+		return v;
 	}
 
+	if (lalloc.lvals == NULL) {
+		lval *slab = lalloc_sys (sizeof(lval) * LALLOC_SLAB);
+		for (int i = 0; i < LALLOC_SLAB; i++) {
+			lfree *f = (lfree*) &slab[i];
+			f->next = lalloc.lvals;
+			lalloc.lvals = f;
+		}
+	}
+	v = (lval*) lalloc.lvals;
+	lalloc.lvals = lalloc.lvals->next;
+	v->arena = 0;
+	v->refs = 1;
 	return v;
 }
 
-/* Return the list minus the first element (tail) CDR */
-lval *builtin_rest (lval *a)
+void lval_free (lval *v)
 {
-	LASSERT (a, a->count == 1,
-		 "Function 'rest' passed too many arguments.");
-	LASSERT (a, a->cell[0]->type == LVAL_QEXPR,
-		 "Function 'rest' passed incorrect type.");
-	LASSERT (a, a->cell[0]->count != 0,
-		 "Function 'rest' passed {}.");
-
-	lval *v = lval_take (a, 0);
-	lval_del (lval_pop (v, 0));
-	return v;
+	lalloc_stats.lval_frees++;
+	if (v->arena)
+		return;
+	lfree *f = (lfree*) v;
+	f->next = lalloc.lvals;
+	lalloc.lvals = f;
 }
 
-/* Return a S-Expression from a Q-Expression and evaluates it */
-lval *builtin_eval (lval *a)
+/* Size class for n cells, LALLOC_CLASSES if too big for any */
+static int lcells_class (int n)
 {
-	LASSERT (a, a->count == 1,
-		 "Function 'eval' passed too many arguments.");
-	LASSERT (a, a->cell[0]->type == LVAL_QEXPR,
-		 "Function 'eval' passed incorrect type.");
+	if (n > 1 << (LALLOC_CLASSES - 1))
+		return LALLOC_CLASSES;
 
-	lval *x = lval_take(a, 0);
-	x->type = LVAL_SEXPR;
-	return lval_eval (x);
+	int c = 0;
+	while (c < LALLOC_CLASSES && (1 << c) < n)
+		c++;
+	return c;
 }
 
-/* Return a joint Q-Expression from N Q-Expression in input */
-lval *builtin_conj (lval *a)
+static lval **lcells_alloc (lval *owner, int n)
 {
-	for (int i = 0; i < a->count; i++) {
-		LASSERT (a, a->cell[i]->type == LVAL_QEXPR,
-			 "Function 'conj' passed incorrect type.");
-	}
+	lalloc_stats.cell_allocs++;
 
-	lval *x = lval_pop (a, 0);
+	if (owner->arena)
+		return larena_alloc (sizeof(lval*) * n);
 
-  /* For each cell in y add it to x */
-	while (a->count) {
-		x = lval_conj (x, lval_pop (a, 0));
-	}
+	int c = lcells_class (n);
+	if (c == LALLOC_CLASSES)
+		return lalloc_sys (sizeof(lval*) * n);
 
-	lval_del (a);
+	if (lalloc.cells[c] == NULL)
+		return lalloc_sys (sizeof(lval*) * (1 << c));
 
-	return x;
+	lfree *f = lalloc.cells[c];
+	lalloc.cells[c] = f->next;
+	return (lval**) f;
 }
 
-lval *builtin_op (lval *a, char *op)
+static void lcells_free (lval *owner, lval **cell, int n)
 {
-	/* Ensure all arguments are numbers */
-	for (int i = 0; i < a->count; i++) {
-		if (a->cell[i]->type != LVAL_NUM) {
-			lval_del (a);
-			return lval_err ("Cannot operate on non-number!");
-		}
-	}
-
-	/* Pop the first element */
-	lval *x = lval_pop (a, 0);
+	if (cell == NULL)
+		return;
+	lalloc_stats.cell_frees++;
 
-	/* If no argument and sub then perform unary negation */
-	if ((strcmp (op, "-") == 0) && a->count == 0)
-		x->num = -x->num;
+	if (owner->arena)
+		return;
 
-	/* While there are still elements remaining */
-	while (a->count > 0) {
-		/* Pop the next element */
-		lval *y = lval_pop (a, 0);
+	int c = lcells_class (n);
+	if (c == LALLOC_CLASSES) {
+		free (cell);
+		return;
+	}
+	lfree *f = (lfree*) cell;
+	f->next = lalloc.cells[c];
+	lalloc.cells[c] = f;
+}
 
-		/* Perform operation */
-		if (strcmp (op, "+") == 0)
-			x->num += y->num;
+/* Slots actually available in a block allocated for n cells */
+static int lcells_capacity (lval *owner, int n)
+{
+	int c = lcells_class (n);
+	if (owner->arena || c == LALLOC_CLASSES)
+		return n;
+	return 1 << c;
+}
 
-		if (strcmp (op, "-") == 0)
-			x->num -= y->num;
+/* Move the cells of v to a block of at least n slots, closing the gap
+   left in front by popped cells */
+void lval_cells_resize (lval *v, int n)
+{
+	lval **base = v->cell ? v->cell - v->front : NULL;
 
-		if (strcmp (op, "*") == 0)
-			x->num *= y->num;
+	if (n == 0) {
+		lcells_free (v, base, v->cap);
+		v->cell = NULL;
+		v->front = v->cap = 0;
+		return;
+	}
 
-		if (strcmp (op, "/") == 0) {
-			if (y->num == 0) {
-				lval_del (x);
-				lval_del (y);
-				x = lval_err ("Division by zero.");
-				break;
-			}
-			x->num /= y->num;
+	int cap = lcells_capacity (v, n);
+	lval **cell;
+	if (base && v->front == 0 && !v->arena
+	    && lcells_class (v->cap) == LALLOC_CLASSES
+	    && lcells_class (cap) == LALLOC_CLASSES) {
+		/* Both outside the classes, let realloc try in place */
+		lalloc_stats.sys_allocs++;
+		cell = realloc (base, sizeof(lval*) * cap);
+	} else {
+		cell = lcells_alloc (v, cap);
+		if (base) {
+			memcpy (cell, v->cell, sizeof(lval*) * v->count);
+			lcells_free (v, base, v->cap);
 		}
-
-		/* Delete element now finished with */
-		lval_del (y);
 	}
-
-	/* Delete input expression and return result */
-	lval_del (a);
-	return x;
+	v->cell = cell;
+	v->front = 0;
+	v->cap = cap;
 }
 
-lval *builtin (lval *a, char *func)
+/* Strings owned by an lval follow its arena */
+char *lval_strdup (lval *owner, const char *s)
 {
-	if (strcmp ("list", func) == 0)
-		return builtin_list (a);
-
-	if (strcmp ("first", func) == 0)
-		return builtin_first (a);
+	size_t n = strlen (s) + 1;
+	char *c = owner->arena ? larena_alloc (n) : malloc (n);
+	memcpy (c, s, n);
+	return c;
+}
 
-	if (strcmp ("rest", func) == 0)
-		return builtin_rest (a);
+void lval_strfree (lval *owner, char *s)
+{
+	if (!owner->arena)
+		free (s);
+}
 
-	if (strcmp ("conj", func) == 0)
-		return builtin_conj (a);
+void lalloc_stats_print (void)
+{
+	fflush (stdout);
+	fprintf (stderr,
+		 "; lval %lu/%lu cells %lu/%lu arena %lu (%lu resets) malloc %lu\n",
+		 lalloc_stats.lval_allocs, lalloc_stats.lval_frees,
+		 lalloc_stats.cell_allocs, lalloc_stats.cell_frees,
+		 lalloc_stats.arena_allocs, lalloc_stats.arena_resets,
+		 lalloc_stats.sys_allocs);
+}
 
-	if (strcmp ("eval", func) == 0)
-		return builtin_eval (a);
+/* Symbol interning
+ *
+ * Every symbol name is stored once in a global open addressing table and
+ * lval_sym points at that copy, so two symbols are equal exactly when
+ * their sym pointers are. Interned names are never freed.
+ */
+#define LINTERN_POOL (16 * 1024)
 
-	if (strstr ("+-/*%", func))
-		return builtin_op (a, func);
+struct {
+	char **slots;
+	int count;
+	int size;      /* Always a power of two */
+	char *pool;    /* Bump storage for the names */
+	size_t pool_left;
+} lintern_table;
 
-	lval_del (a);
-	return lval_err ("Unknown function!");
+static unsigned long lintern_hash (const char *s)
+{
+	/* FNV-1a */
+	unsigned long h = 2166136261UL;
+	while (*s) {
+		h ^= (unsigned char) *s++;
+		h *= 16777619UL;
+	}
+	return h;
 }
 
-
-lval *lval_eval_sexpr (lval *v)
+static char *lintern_store (const char *s)
 {
-	/* Evaluate children */
-	for (int i = 0; i < v->count; i++)
-		v->cell[i] = lval_eval (v->cell[i]);
-
-	/* Error checking */
-	for (int i = 0; i < v->count; i++) {
-		if (v->cell[i]->type == LVAL_ERR)
-			return lval_take (v, i);
+	size_t n = strlen (s) + 1;
+	if (n > lintern_table.pool_left) {
+		size_t size = n > LINTERN_POOL ? n : LINTERN_POOL;
+		lintern_table.pool = malloc (size);
+		lintern_table.pool_left = size;
 	}
+	char *c = lintern_table.pool;
+	memcpy (c, s, n);
+	lintern_table.pool += n;
+	lintern_table.pool_left -= n;
+	return c;
+}
 
-	/* Empty Expression */
-	if (v->count == 0)
-		return v;
-
-	/* Single Expression */
-	if (v->count == 1)
-		return lval_take (v, 0);
-
-	/* Ensure first Element is Symbol */
-	lval *f = lval_pop (v, 0);
-	if (f->type != LVAL_SYM) {
-		lval_del (f);
-		lval_del (v);
-		return lval_err ("S-Expression does not start with symbol.");
+static void lintern_grow (void)
+{
+	int size = lintern_table.size ? lintern_table.size * 2 : 256;
+	char **slots = calloc (size, sizeof(char*));
+	for (int i = 0; i < lintern_table.size; i++) {
+		char *s = lintern_table.slots[i];
+		if (s == NULL)
+			continue;
+		unsigned long j = lintern_hash (s) & (size - 1);
+		while (slots[j])
+			j = (j + 1) & (size - 1);
+		slots[j] = s;
 	}
-
-	/* Call builtin with operator */
-	lval *result = builtin (v, f->sym);
-	lval_del (f);
-	return result;
+	free (lintern_table.slots);
+	lintern_table.slots = slots;
+	lintern_table.size = size;
 }
 
-lval *lval_eval(lval *v)
+/* Return the unique copy of s */
+char *lintern (const char *s)
 {
-	/* Evaluate S-Expressions */
-	if (v->type == LVAL_SEXPR)
-		return lval_eval_sexpr (v);
+	if (2 * (lintern_table.count + 1) > lintern_table.size)
+		lintern_grow ();
 
-	/* All other lvla types return the same */
-	return v;
+	int mask = lintern_table.size - 1;
+	unsigned long i = lintern_hash (s) & mask;
+	while (lintern_table.slots[i]) {
+		if (strcmp (lintern_table.slots[i], s) == 0)
+			return lintern_table.slots[i];
+		i = (i + 1) & mask;
+	}
+	lintern_table.count++;
+	return lintern_table.slots[i] = lintern_store (s);
 }
 
+/* Environment
+ *
+ * Bindings live in an open addressing table keyed by the interned symbol
+ * pointer, so lookup is a multiplicative hash of the pointer followed by
+ * a short linear probe comparing pointers. The table is kept at most
+ * half full.
+ */
+struct lenv {
+  int count;
+  int version;    /* Bumped by every lenv_put */
+  int size;       /* Slots, always a power of two */
+  int bits;       /* log2 of size */
+  char **syms;    /* Interned names, NULL for an empty slot */
+  lval **vals;
+};
+
+lval *lval_err (char *m);
+lval *lval_copy (lval *v);
+void lval_del (lval *v);
 
-lval *lval_read_num(mpc_ast_t *t)
+/* Fibonacci hashing: the top bits of the product depend on every bit of
+   the pointer. Interned names are packed byte by byte, so the low bits of
+   sym carry as much as any */
+static inline int lenv_hash (char *sym, int bits)
 {
-	errno = 0;
-	long x = strtol(t->contents, NULL, 10);
-	return errno != ERANGE ? lval_num(x) : lval_err("Invalid number");
+  return (int) (((uint64_t) (uintptr_t) sym * 11400714819323198485ULL)
+                >> (64 - bits));
 }
 
-lval *lval_read(mpc_ast_t *t)
+/* Slot of sym, or of the empty slot where it would go */
+static inline int lenv_slot (lenv *e, char *sym)
 {
-  if (strstr(t->tag, "number"))
-	  return lval_read_num(t);
-
-  if (strstr(t->tag, "symbol"))
-	  return lval_sym(t->contents);
-
-  /* If root (>) or sexpr create empty list */
-  lval *x = NULL;
-  if (strcmp(t->tag, ">") == 0)
-	  x = lval_sexpr();
-
-  if (strcmp(t->tag, "sexpr"))
-	  x = lval_sexpr();
-
-  if (strstr(t->tag, "qexpr"))
-	  x = lval_qexpr();
-
-  /* Fill the list with any valid expression contained within */
-  for (int i = 0; i < t->children_num; i++) {
-    if (strcmp(t->children[i]->contents, "(") == 0)
-	    continue;
-    if (strcmp(t->children[i]->contents, ")") == 0)
-	    continue;
-    if (strcmp(t->children[i]->contents, "}") == 0)
-	    continue;
-    if (strcmp(t->children[i]->contents, "{") == 0)
-	    continue;
-    if (strcmp(t->children[i]->tag, "regex") == 0)
-	    continue;
-    x = lval_add(x, lval_read(t->children[i]));
-  }
+  int mask = e->size - 1;
+  int i = lenv_hash(sym, e->bits);
+  while (e->syms[i] && e->syms[i] != sym)
+    i = (i + 1) & mask;
+  return i;
+}
 
-  return x;
+lenv *lenv_new(void)
+{
+  lenv *e = malloc(sizeof(lenv));
+  e->count = 0;
+  e->version = 0;
+  e->size = 16;
+  e->bits = 4;
+  e->syms = calloc(e->size, sizeof(char*));
+  e->vals = calloc(e->size, sizeof(lval*));
+  return e;
 }
 
-int main(int argc, char** argv)
+void lenv_del (lenv *e)
 {
-  /* Create parsers */
-  // TODO define JSON grammar
+  /* Names are interned, only the values are owned */
+  for (int i = 0; i < e->size; i++)
+  {
+    if (e->syms[i])
+      lval_del(e->vals[i]);
+  }
+  free(e->syms);
+  free(e->vals);
+  free(e);
+}
+
+static void lenv_grow (lenv *e)
+{
+  char **syms = e->syms;
+  lval **vals = e->vals;
+  int size = e->size;
+
+  e->size *= 2;
+  e->bits++;
+  e->syms = calloc(e->size, sizeof(char*));
+  e->vals = calloc(e->size, sizeof(lval*));
+  for (int i = 0; i < size; i++)
+  {
+    if (syms[i] == NULL)
+      continue;
+    int j = lenv_slot(e, syms[i]);
+    e->syms[j] = syms[i];
+    e->vals[j] = vals[i];
+  }
+  free(syms);
+  free(vals);
+}
+
+lval *lenv_get(lenv *e, lval *k)
+{
+  int i = lenv_slot(e, k->sym);
+  if (e->syms[i])
+    return lval_copy(e->vals[i]);
+
+  /* If not symbol return error */
+  return lval_err("Unbound symbol!");
+}
+
+/* Bind k to a copy of v, replacing any previous binding */
+void lenv_put(lenv *e, lval *k, lval *v)
+{
+  e->version++;
+  int i = lenv_slot(e, k->sym);
+  if (e->syms[i])
+  {
+    lval_del(e->vals[i]);
+    e->vals[i] = lval_copy(v);
+    return;
+  }
+
+  if (2 * (e->count + 1) > e->size)
+  {
+    lenv_grow(e);
+    i = lenv_slot(e, k->sym);
+  }
+  e->syms[i] = k->sym;
+  e->vals[i] = lval_copy(v);
+  e->count++;
+}
+
+/* lval fun Type */
+lval *lval_fun(lbuiltin_def *func) {
+  lval *v = lval_alloc();
+  v->type = LVAL_FUN;
+  v->fun = func;
+  return v;
+}
+
+/* Bignums
+ *
+ * Numbers beyond a long are boxed LVAL_NUMs with big set: a sign and the
+ * magnitude in base 2^32 digits, least significant first, without
+ * leading zeros. Results go back to a long whenever they fit, so a
+ * bignum never holds a value a long could. Products of two factors of
+ * LBIG_KARATSUBA digits or more are split Karatsuba style.
+ */
+#define LBIG_KARATSUBA 32
+
+/* Work done by evaluation so far, in steps of about one item evaluated.
+   Digit products and vector elements count LWORK_UNITS to a step. The
+   memo cache weighs what an evaluation cost by it, so what is cached
+   does not depend on timing */
+static unsigned long lwork;
+#define LWORK_UNITS 8
+
+struct lbig {
+	int neg;
+	int n;
+	uint32_t d[];
+};
+
+static lbig *lbig_new (int n)
+{
+	lbig *b = malloc (sizeof(lbig) + sizeof(uint32_t) * (n ? n : 1));
+	b->neg = 0;
+	b->n = n;
+	memset (b->d, 0, sizeof(uint32_t) * n);
+	return b;
+}
+
+static lbig *lbig_dup (lbig *b)
+{
+	lbig *x = lbig_new (b->n);
+	x->neg = b->neg;
+	memcpy (x->d, b->d, sizeof(uint32_t) * b->n);
+	return x;
+}
+
+/* Drop leading zero digits, zero has no sign */
+static lbig *lbig_trim (lbig *b)
+{
+	while (b->n > 0 && b->d[b->n - 1] == 0)
+		b->n--;
+	if (b->n == 0)
+		b->neg = 0;
+	return b;
+}
+
+static lbig *lbig_from_long (long x)
+{
+	unsigned long m = x < 0 ? -(unsigned long) x : (unsigned long) x;
+	lbig *b = lbig_new (sizeof(long) / sizeof(uint32_t) + 1);
+	b->neg = x < 0;
+	for (int i = 0; m; i++) {
+		b->d[i] = (uint32_t) m;
+		m = m >> 31 >> 1;
+	}
+	return lbig_trim (b);
+}
+
+/* Value of b as a long, if it fits */
+static int lbig_to_long (lbig *b, long *x)
+{
+	if (b->n > (int) (sizeof(long) / sizeof(uint32_t)))
+		return 0;
+
+	unsigned long m = 0;
+	for (int i = b->n - 1; i >= 0; i--)
+		m = (m << 31 << 1) | b->d[i];
+
+	if (!b->neg && m <= LONG_MAX)
+		*x = (long) m;
+	else if (b->neg && m <= (unsigned long) LONG_MAX + 1)
+		*x = m == (unsigned long) LONG_MAX + 1 ? LONG_MIN : -(long) m;
+	else
+		return 0;
+	return 1;
+}
+
+/* Order of the magnitudes a[0..an) and b[0..bn), both trimmed */
+static int lmag_cmp (const uint32_t *a, int an, const uint32_t *b, int bn)
+{
+	if (an != bn)
+		return an < bn ? -1 : 1;
+	for (int i = an - 1; i >= 0; i--) {
+		if (a[i] != b[i])
+			return a[i] < b[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+/* r[0..rn) += b[0..bn) for bn <= rn, returns the carry out of r */
+static uint32_t lmag_add_to (uint32_t *r, int rn, const uint32_t *b, int bn)
+{
+	uint64_t c = 0;
+	int i = 0;
+	for (; i < bn; i++) {
+		c += (uint64_t) r[i] + b[i];
+		r[i] = (uint32_t) c;
+		c >>= 32;
+	}
+	for (; c && i < rn; i++) {
+		c += r[i];
+		r[i] = (uint32_t) c;
+		c >>= 32;
+	}
+	return (uint32_t) c;
+}
+
+/* r[0..rn) -= b[0..bn) for bn <= rn, returns the borrow out of r */
+static uint32_t lmag_sub_from (uint32_t *r, int rn, const uint32_t *b, int bn)
+{
+	uint32_t borrow = 0;
+	int i = 0;
+	for (; i < bn; i++) {
+		uint64_t t = (uint64_t) r[i] - b[i] - borrow;
+		r[i] = (uint32_t) t;
+		borrow = t >> 63;
+	}
+	for (; borrow && i < rn; i++) {
+		uint64_t t = (uint64_t) r[i] - borrow;
+		r[i] = (uint32_t) t;
+		borrow = t >> 63;
+	}
+	return borrow;
+}
+
+/* r[0..an+bn) = a * b, digit by digit */
+static void lmag_mul_school (uint32_t *r, const uint32_t *a, int an,
+			     const uint32_t *b, int bn)
+{
+	memset (r, 0, sizeof(uint32_t) * (an + bn));
+	for (int i = 0; i < an; i++) {
+		uint64_t c = 0;
+		for (int j = 0; j < bn; j++) {
+			c += (uint64_t) a[i] * b[j] + r[i + j];
+			r[i + j] = (uint32_t) c;
+			c >>= 32;
+		}
+		r[i + bn] = (uint32_t) c;
+	}
+}
+
+/* r[0..an+bn) = a * b */
+static void lmag_mul (uint32_t *r, const uint32_t *a, int an,
+		      const uint32_t *b, int bn)
+{
+	if (an < bn) {
+		const uint32_t *t = a;
+		a = b;
+		b = t;
+		int tn = an;
+		an = bn;
+		bn = tn;
+	}
+
+	if (bn < LBIG_KARATSUBA) {
+		lmag_mul_school (r, a, an, b, bn);
+		return;
+	}
+
+	/* Much longer a, multiply b by one slice of a at a time */
+	if (an >= 2 * bn) {
+		uint32_t *t = malloc (sizeof(uint32_t) * 2 * bn);
+		memset (r, 0, sizeof(uint32_t) * (an + bn));
+		for (int i = 0; i < an; i += bn) {
+			int k = an - i < bn ? an - i : bn;
+			lmag_mul (t, a + i, k, b, bn);
+			lmag_add_to (r + i, an + bn - i, t, k + bn);
+		}
+		free (t);
+		return;
+	}
+
+	/* With a = a1 B^m + a0 and b = b1 B^m + b0,
+	   a b = a1 b1 B^2m + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) B^m + a0 b0 */
+	int m = (an + 1) / 2;
+	int a1n = an - m, b1n = bn - m;
+	uint32_t *t = malloc (sizeof(uint32_t) * 4 * (m + 1));
+	uint32_t *sa = t, *sb = t + m + 1, *z1 = t + 2 * (m + 1);
+
+	memcpy (sa, a, sizeof(uint32_t) * m);
+	sa[m] = lmag_add_to (sa, m, a + m, a1n);
+	memcpy (sb, b, sizeof(uint32_t) * m);
+	sb[m] = lmag_add_to (sb, m, b + m, b1n);
+
+	lmag_mul (r, a, m, b, m);
+	lmag_mul (r + 2 * m, a + m, a1n, b + m, b1n);
+	lmag_mul (z1, sa, m + 1, sb, m + 1);
+	lmag_sub_from (z1, 2 * m + 2, r, 2 * m);
+	lmag_sub_from (z1, 2 * m + 2, r + 2 * m, a1n + b1n);
+
+	/* The middle term fits in what is left of r once trimmed */
+	int zn = 2 * m + 2;
+	while (zn > 0 && z1[zn - 1] == 0)
+		zn--;
+	lmag_add_to (r + m, an + bn - m, z1, zn);
+	free (t);
+}
+
+/* q[0..an-bn] = a / b and r[0..bn) = a % b, for trimmed a and b with
+   an >= bn > 0. Knuth's algorithm D */
+static void lmag_divmod (uint32_t *q, uint32_t *r, const uint32_t *a, int an,
+			 const uint32_t *b, int bn)
+{
+	if (bn == 1) {
+		uint64_t rem = 0;
+		for (int i = an - 1; i >= 0; i--) {
+			rem = (rem << 32) | a[i];
+			q[i] = (uint32_t) (rem / b[0]);
+			rem %= b[0];
+		}
+		r[0] = (uint32_t) rem;
+		return;
+	}
+
+	/* Shift so the top digit of the divisor has its high bit set */
+	int s = 0;
+	while (!(b[bn - 1] << s & 0x80000000u))
+		s++;
+
+	uint32_t *un = malloc (sizeof(uint32_t) * (an + 1));
+	uint32_t *vn = malloc (sizeof(uint32_t) * bn);
+	for (int i = bn - 1; i > 0; i--)
+		vn[i] = (b[i] << s) | (uint32_t) ((uint64_t) b[i - 1] >> (32 - s));
+	vn[0] = b[0] << s;
+	un[an] = (uint32_t) ((uint64_t) a[an - 1] >> (32 - s));
+	for (int i = an - 1; i > 0; i--)
+		un[i] = (a[i] << s) | (uint32_t) ((uint64_t) a[i - 1] >> (32 - s));
+	un[0] = a[0] << s;
+
+	for (int j = an - bn; j >= 0; j--) {
+		/* Estimate the quotient digit from the top two digits */
+		uint64_t num = ((uint64_t) un[j + bn] << 32) | un[j + bn - 1];
+		uint64_t qhat = num / vn[bn - 1];
+		uint64_t rhat = num % vn[bn - 1];
+		while (qhat >> 32
+		       || qhat * vn[bn - 2] > ((rhat << 32) | un[j + bn - 2])) {
+			qhat--;
+			rhat += vn[bn - 1];
+			if (rhat >> 32)
+				break;
+		}
+
+		/* Multiply and subtract */
+		int64_t k = 0, t;
+		for (int i = 0; i < bn; i++) {
+			uint64_t p = qhat * vn[i];
+			t = un[i + j] - k - (int64_t) (p & 0xffffffffu);
+			un[i + j] = (uint32_t) t;
+			k = (int64_t) (p >> 32) - (t >> 32);
+		}
+		t = un[j + bn] - k;
+		un[j + bn] = (uint32_t) t;
+
+		/* Subtracted once too often, add back */
+		q[j] = (uint32_t) qhat;
+		if (t < 0) {
+			q[j]--;
+			un[j + bn] += lmag_add_to (un + j, bn, vn, bn);
+		}
+	}
+
+	for (int i = 0; i < bn; i++)
+		r[i] = (un[i] >> s) | (uint32_t) ((uint64_t) un[i + 1] << (32 - s));
+	free (un);
+	free (vn);
+}
+
+/* a + b, or a - b when sub */
+static lbig *lbig_add (lbig *a, lbig *b, int sub)
+{
+	int bneg = b->neg ^ sub;
+
+	if (a->neg == bneg) {
+		lbig *x = a->n >= b->n ? a : b, *y = x == a ? b : a;
+		lbig *r = lbig_new (x->n + 1);
+		memcpy (r->d, x->d, sizeof(uint32_t) * x->n);
+		r->d[x->n] = lmag_add_to (r->d, x->n, y->d, y->n);
+		r->neg = a->neg;
+		return lbig_trim (r);
+	}
+
+	/* Opposite signs, take the smaller magnitude off the larger */
+	int c = lmag_cmp (a->d, a->n, b->d, b->n);
+	lbig *x = c >= 0 ? a : b, *y = c >= 0 ? b : a;
+	lbig *r = lbig_new (x->n);
+	memcpy (r->d, x->d, sizeof(uint32_t) * x->n);
+	lmag_sub_from (r->d, x->n, y->d, y->n);
+	r->neg = c >= 0 ? a->neg : bneg;
+	return lbig_trim (r);
+}
+
+static lbig *lbig_mul (lbig *a, lbig *b)
+{
+	lwork += (unsigned long) a->n * b->n / LWORK_UNITS;
+	lbig *r = lbig_new (a->n + b->n);
+	if (a->n && b->n)
+		lmag_mul (r->d, a->d, a->n, b->d, b->n);
+	r->neg = a->neg ^ b->neg;
+	return lbig_trim (r);
+}
+
+/* a / b, or a % b when mod, truncated like C does. b is not zero */
+static lbig *lbig_divmod (lbig *a, lbig *b, int mod)
+{
+	if (lmag_cmp (a->d, a->n, b->d, b->n) < 0)
+		return mod ? lbig_dup (a) : lbig_new (0);
+
+	lwork += (unsigned long) (a->n - b->n + 1) * b->n / LWORK_UNITS;
+	lbig *q = lbig_new (a->n - b->n + 1);
+	lbig *r = lbig_new (b->n);
+	lmag_divmod (q->d, r->d, a->d, a->n, b->d, b->n);
+	q->neg = a->neg ^ b->neg;
+	r->neg = a->neg;
+	free (mod ? q : r);
+	return lbig_trim (mod ? r : q);
+}
+
+/* Bignum for the decimal digits of s, after an optional minus sign */
+static lbig *lbig_read (const char *s)
+{
+	int neg = *s == '-';
+	if (neg)
+		s++;
+
+	/* Nine decimal digits fit a digit, and take at least 29 bits */
+	lbig *b = lbig_new ((int) strlen (s) / 9 + 2);
+	int n = 0;
+	while (*s) {
+		uint32_t chunk = 0, scale = 1;
+		for (int k = 0; k < 9 && *s; k++, s++) {
+			chunk = chunk * 10 + (uint32_t) (*s - '0');
+			scale *= 10;
+		}
+		uint64_t c = chunk;
+		for (int i = 0; i < n; i++) {
+			c += (uint64_t) b->d[i] * scale;
+			b->d[i] = (uint32_t) c;
+			c >>= 32;
+		}
+		if (c)
+			b->d[n++] = (uint32_t) c;
+	}
+	b->n = n;
+	b->neg = neg;
+	return lbig_trim (b);
+}
+
+static void lbig_print (lbig *b)
+{
+	/* Peel nine decimal digits off at a time, lowest first */
+	int n = b->n, k = 0;
+	uint32_t *d = malloc (sizeof(uint32_t) * (n ? n : 1));
+	uint32_t *chunks = malloc (sizeof(uint32_t) * (2 * n + 1));
+	memcpy (d, b->d, sizeof(uint32_t) * n);
+	do {
+		uint64_t rem = 0;
+		for (int i = n - 1; i >= 0; i--) {
+			rem = (rem << 32) | d[i];
+			d[i] = (uint32_t) (rem / 1000000000u);
+			rem %= 1000000000u;
+		}
+		chunks[k++] = (uint32_t) rem;
+		while (n > 0 && d[n - 1] == 0)
+			n--;
+	} while (n > 0);
+
+	if (b->neg)
+		putchar ('-');
+	printf ("%u", (unsigned) chunks[--k]);
+	while (k > 0)
+		printf ("%09u", (unsigned) chunks[--k]);
+	free (d);
+	free (chunks);
+}
+
+/* Bignums owned by an lval follow its arena */
+static lbig *lbig_keep (lval *owner, lbig *b)
+{
+	if (!owner->arena)
+		return b;
+	size_t n = sizeof(lbig) + sizeof(uint32_t) * b->n;
+	lbig *x = larena_alloc (n);
+	memcpy (x, b, n);
+	free (b);
+	return x;
+}
+
+static void lbig_free (lval *owner, lbig *b)
+{
+	if (!owner->arena)
+		free (b);
+}
+
+/* Is the number v a bignum */
+static inline int lval_is_big (lval *v)
+{
+	return !lval_is_immediate (v) && v->big;
+}
+
+/* Value of the number v as a new bignum */
+static lbig *lval_to_big (lval *v)
+{
+	if (lval_is_big (v))
+		return lbig_dup (v->big);
+	return lbig_from_long (lval_number (v));
+}
+
+lval *lval_num (long x);
+
+/* Number holding the value of b, which it takes over */
+lval *lval_from_big (lbig *b)
+{
+	long x;
+	if (lbig_to_long (b, &x)) {
+		free (b);
+		return lval_num (x);
+	}
+
+	lval *v = lval_alloc ();
+	v->type = LVAL_NUM;
+	v->num = 0;
+	v->big = lbig_keep (v, b);
+	return v;
+}
+
+/* lval Number Type */
+lval *lval_num (long x)
+{
+	if (x >= LVAL_FIXNUM_MIN && x <= LVAL_FIXNUM_MAX)
+		return lval_fixnum (x);
+
+	lval *v = lval_alloc ();
+	v->type = LVAL_NUM;
+	v->num = x;
+	v->big = NULL;
+	return v;
+}
+
+/* lval Double Type */
+lval *lval_dbl (double x)
+{
+	lval *v = lval_flonum (x);
+	if (v)
+		return v;
+
+	v = lval_alloc ();
+	v->type = LVAL_DBL;
+	v->dbl = x;
+	return v;
+}
+
+/* lval Error Type */
+lval *lval_err(char *m)
+{
+	lval *v = lval_alloc ();
+	v->type = LVAL_ERR;
+	v->err = lval_strdup (v, m);
+	return v;
+}
+
+/* lval Symbol */
+lval *lval_sym(char *s)
+{
+	lval *v = lval_alloc();
+	v->type = LVAL_SYM;
+	v->sym = lintern(s);
+	return v;
+}
+
+/* Empty lval Sexpr */
+lval *lval_sexpr(void)
+{
+	lval *v = lval_alloc();
+	v->type = LVAL_SEXPR;
+	v->count = 0;
+	v->front = v->cap = 0;
+	v->cell = NULL;
+	return v;
+}
+
+/* A pointer to new empty Qexpr lval */
+lval *lval_qexpr(void)
+{
+	lval *v = lval_alloc();
+	v->type = LVAL_QEXPR;
+	v->count = 0;
+	v->front = v->cap = 0;
+	v->cell = NULL;
+	return v;
+}
+
+/* Packed vectors
+ *
+ * A Q-Expression of numbers all of one type, longs or doubles, is stored
+ * as an LVAL_VEC: the numbers themselves in one contiguous block instead
+ * of a cell per number. The block comes from the cell allocator, each
+ * number taking the slots of a double. To the language it is just a
+ * Q-Expression, code that only knows cells unpacks it first.
+ *
+ * The block starts with the count of vectors using it: copies and rests
+ * of a vector share its block, each with its own front and count. Only
+ * the sole user of a block may write to it.
+ */
+#define lvec_ints(v)  ((long*) ((double*) (v)->pack + 1) + (v)->front)
+#define lvec_dbls(v)  ((double*) (v)->pack + 1 + (v)->front)
+#define lvec_users(v) (*(int*) (v)->pack)
+
+/* Cell slots holding n packed numbers and the header */
+static int lvec_slots (int n)
+{
+	return ((n + 1) * sizeof(double) + sizeof(lval*) - 1) / sizeof(lval*);
+}
+
+static size_t lvec_width (lval *v)
+{
+	return v->elem == LVAL_DBL ? sizeof(double) : sizeof(long);
+}
+
+/* Drop the use v makes of its block */
+static void lvec_release (lval *v)
+{
+	if (v->pack && --lvec_users (v) == 0)
+		lcells_free (v, v->pack, lvec_slots (v->cap));
+	v->pack = NULL;
+}
+
+/* Move the numbers of v to a block of its own with room for n, closing
+   the gap left in front by popped numbers */
+static void lvec_resize (lval *v, int n)
+{
+	void *pack = NULL;
+	int cap = 0;
+
+	if (n > 0) {
+		int slots = lcells_capacity (v, lvec_slots (n));
+		pack = lcells_alloc (v, slots);
+		*(int*) pack = 1;
+		cap = slots * sizeof(lval*) / sizeof(double) - 1;
+		if (v->count)
+			memcpy ((double*) pack + 1, lvec_ints (v),
+				v->count * lvec_width (v));
+	}
+	lvec_release (v);
+
+	v->pack = pack;
+	v->front = 0;
+	v->cap = cap;
+}
+
+/* Point the empty vector x at the n numbers of v from i on. The block is
+   shared unless just one of them lives in the line arena */
+static void lvec_view (lval *x, lval *v, int i, int n)
+{
+	x->elem = v->elem;
+	if (n == 0)
+		return;
+
+	if (x->arena == v->arena) {
+		x->pack = v->pack;
+		lvec_users (x)++;
+		x->front = v->front + i;
+		x->cap = v->cap;
+	} else {
+		lvec_resize (x, n);
+		memcpy (lvec_ints (x), (char*) lvec_ints (v) + i * lvec_width (v),
+			n * lvec_width (v));
+	}
+	x->count = n;
+}
+
+/* New vector of n numbers of type elem, for the caller to fill in */
+lval *lval_vec (int elem, int n)
+{
+	lval *v = lval_alloc ();
+	v->type = LVAL_VEC;
+	v->elem = elem;
+	v->count = 0;
+	v->front = v->cap = 0;
+	v->pack = NULL;
+	if (n)
+		lvec_resize (v, n);
+	v->count = n;
+	return v;
+}
+
+/* Number i of the vector v */
+static lval *lvec_get (lval *v, int i)
+{
+	if (v->elem == LVAL_DBL)
+		return lval_dbl (lvec_dbls (v)[i]);
+	return lval_num (lvec_ints (v)[i]);
+}
+
+/* Persistent lists
+ *
+ * Other Q-Expressions of LRRB_MIN items or more are kept as relaxed radix
+ * balanced trees, LVAL_RRB: leaves of up to LRRB_M items under nodes of up
+ * to LRRB_M children, all leaves at the same depth. A node never changes
+ * once built, so lists share them freely. rest is a slice and conj a
+ * concatenation, each building only the O(log n) nodes along the edges
+ * it cuts or joins. Every node keeps the running sizes of its children,
+ * leaves need not be full and indexing searches each level for its child.
+ */
+#define LRRB_M   32
+#define LRRB_MIN (2 * LRRB_M)
+
+typedef struct lrrb {
+	int refs;
+	int arena;      /* Set for nodes built in the line arena */
+	int height;     /* 0 for leaves */
+	int count;      /* Items of a leaf, children of a node */
+	int *sizes;     /* Items under children 0..i, nodes only */
+	void *slot[LRRB_M];
+} lrrb;
+
+static void lrrb_unref (lrrb *n);
+
+/* Cons lists
+ *
+ * With LEZ_CONS, Q-Expressions are LVAL_CONS lists of cons cells instead.
+ * The cells are cdr-coded: they come in runs of LCONS_RUN cars side by
+ * side, the cdr of a car is simply the next slot of its run and only the
+ * run as a whole has an explicit cdr, so walking a list mostly reads
+ * consecutive words. Runs fill from the back. Consing onto a list that
+ * starts at the lowest used slot of its run writes the free slot in front
+ * of it, any other cons starts a new run. Slots once written never change,
+ * so lists share runs freely, first, rest and cons are O(1).
+ *
+ * Runs are the same size and come from their own slabs, a dedicated cell
+ * heap next to the lval one, or from the line arena while that is on.
+ */
+#define LCONS_RUN ((128 - 4 * sizeof(int) - sizeof(void*)) / sizeof(lval*))
+
+typedef struct lcons {
+	int refs;
+	int arena;           /* Set for runs taken from the line arena */
+	int lo;              /* Lowest slot in use */
+	int cdr_at;          /* Slot of cdr the list goes on at */
+	struct lcons *cdr;   /* Run after the last slot, NULL at the end */
+	lval *car[LCONS_RUN];
+} lcons;
+
+static void lcons_unref (lcons *r);
+
+/* Nodes waiting to be released by lval_del, so freeing a deeply nested
+   list takes no C stack */
+struct {
+	lval **items;
+	int count, cap;
+	int busy;        /* lval_del is releasing, later calls just queue */
+} ldel;
+
+static void ldel_reserve (int n)
+{
+	if (ldel.count + n > ldel.cap) {
+		ldel.cap = (ldel.count + n) * 2;
+		ldel.items = realloc (ldel.items, sizeof(lval*) * ldel.cap);
+	}
+}
+
+void lval_del(lval *v)
+{
+	/* Trees and cons runs release what they hold through here while a
+	   node is freed, the loop below takes it from there */
+	if (ldel.busy) {
+		if (!lval_is_immediate (v)) {
+			ldel_reserve (1);
+			ldel.items[ldel.count++] = v;
+		}
+		return;
+	}
+	ldel.busy = 1;
+
+	for (;;) {
+		/* Immediates own no memory, shared nodes stay for their owners */
+		if (!lval_is_immediate (v) && --v->refs == 0) {
+			switch (v->type) {
+			case LVAL_NUM:
+				if (v->big)
+					lbig_free (v, v->big);
+				break;
+			case LVAL_ERR:
+				lval_strfree (v, v->err);
+				break;
+			case LVAL_SEXPR:
+			case LVAL_QEXPR:
+				ldel_reserve (v->count);
+				for (int i = 0; i < v->count; i++) {
+					if (!lval_is_immediate (v->cell[i]))
+						ldel.items[ldel.count++] = v->cell[i];
+				}
+				if (v->cell)
+					lcells_free (v, v->cell - v->front, v->cap);
+				break;
+			case LVAL_VEC:
+				lvec_release (v);
+				break;
+			case LVAL_RRB:
+				lrrb_unref (v->rrb);
+				break;
+			case LVAL_CONS:
+				lcons_unref (v->cons);
+				break;
+			case LVAL_FUN:
+			case LVAL_DBL:
+				break;
+			}
+			/* Free the memory allocated for the lval struct itself */
+			lval_free (v);
+		}
+
+		if (ldel.count == 0)
+			break;
+		v = ldel.items[--ldel.count];
+	}
+	ldel.busy = 0;
+}
+
+/* Make room for n items in total without further reallocation */
+lval *lval_reserve (lval *v, int n)
+{
+	if (v->front + n > v->cap)
+		lval_cells_resize (v, n);
+	return v;
+}
+
+lval *lval_add (lval *v, lval *x)
+{
+	/* Grow geometrically so n appends cost O(n) */
+	if (v->front + v->count == v->cap)
+		lval_cells_resize (v, v->count < 4 ? 4 : v->count * 2);
+	v->cell[v->count++] = x;
+	return v;
+}
+
+/* Append the n items at xs to v, taking over their references */
+lval *lval_add_all (lval *v, lval **xs, int n)
+{
+	/* Nothing to add, and cell may be NULL, which memcpy must not see */
+	if (n == 0)
+		return v;
+	if (v->front + v->count + n > v->cap)
+		lval_cells_resize (v, v->count + n > 2 * v->count
+				      ? v->count + n : 2 * v->count);
+	memcpy (&v->cell[v->count], xs, sizeof(lval*) * n);
+	v->count += n;
+	return v;
+}
+
+/* Lists brought into the line arena whose items are not all in it yet */
+struct {
+  lval **items;
+  int count, cap;
+} limport;
+
+/* New node with the contents of v, children are shared. Items that have
+   to be brought into the line arena are left in place, and the list is
+   queued on limport for lval_clone to bring them in */
+static lval *lval_clone_node (lval *v)
+{
+  lval *x = lval_alloc();
+  x->type = v->type;
+
+  switch (v->type) {
+    /* Copy functions and number directly */
+    case LVAL_FUN:
+      x->fun = v->fun;
+      break;
+    case LVAL_NUM:
+      x->num = v->num;
+      x->big = v->big ? lbig_keep(x, lbig_dup(v->big)) : NULL;
+      break;
+    case LVAL_DBL:
+      x->dbl = v->dbl;
+      break;
+    case LVAL_ERR:
+      x->err = lval_strdup(x, v->err);
+      break;
+    case LVAL_SYM:
+      x->sym = v->sym;
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      x->count = 0;
+      x->front = x->cap = 0;
+      x->cell = NULL;
+      if (v->count)
+        lval_reserve(x, v->count);
+      x->count = v->count;
+      int outside = 0;
+      for (int i = 0; i < x->count; i++)
+      {
+        lval *c = v->cell[i];
+        if (lalloc.arena_on && !lval_is_immediate(c) && !c->arena) {
+          x->cell[i] = c;
+          outside = 1;
+        } else {
+          x->cell[i] = lval_copy(c);
+        }
+      }
+      if (outside) {
+        if (limport.count == limport.cap) {
+          limport.cap = limport.cap ? limport.cap * 2 : 64;
+          limport.items = realloc(limport.items, sizeof(lval*) * limport.cap);
+        }
+        limport.items[limport.count++] = x;
+      }
+      break;
+    case LVAL_VEC:
+      x->count = 0;
+      x->front = x->cap = 0;
+      x->pack = NULL;
+      lvec_view(x, v, 0, v->count);
+      break;
+    case LVAL_RRB:
+      x->rrb = v->rrb;
+      x->rrb->refs++;
+      x->count = v->count;
+      break;
+    case LVAL_CONS:
+      x->cons = v->cons;
+      x->cons->refs++;
+      x->front = v->front;
+      x->count = v->count;
+      break;
+  }
+  return x;
+}
+
+/* New unshared node with the contents of v, children are shared. Under
+   the line arena anything outside it is cloned in, one level at a time
+   off limport so that deep lists take no C stack */
+lval *lval_clone (lval *v)
+{
+  int base = limport.count;
+  lval *x = lval_clone_node(v);
+
+  while (limport.count > base) {
+    lval *y = limport.items[--limport.count];
+    for (int i = 0; i < y->count; i++) {
+      lval *c = y->cell[i];
+      if (!lval_is_immediate(c) && !c->arena)
+        y->cell[i] = lval_clone_node(c);
+    }
+  }
+  return x;
+}
+
+/* Values are immutable once shared, so a copy is another reference */
+lval *lval_copy (lval *v)
+{
+  /* Immediates are values, the pointer is the copy */
+  if (lval_is_immediate(v))
+    return v;
+
+  /* Line arena values may not point outside of it, bring v in */
+  if (lalloc.arena_on && !v->arena)
+    return lval_clone(v);
+
+  v->refs++;
+  return v;
+}
+
+/* Make v safe to change in place, copying it if it is shared */
+lval *lval_unshare (lval *v)
+{
+  if (lval_is_immediate(v) || v->refs == 1)
+    return v;
+
+  lval *x = lval_clone(v);
+  lval_del(v);
+  return x;
+}
+
+/* Cells are only given back once three quarters of the block is unused */
+#define LCELLS_SHRINK_MIN 32
+
+lval *lval_pop (lval *v, int i)
+{
+	/* Find the item at i */
+	lval *x = v->cell[i];
+
+	/* Close the hole from the shorter side, the head is just skipped */
+	if (i < v->count / 2) {
+		memmove (&v->cell[1], &v->cell[0], sizeof(lval*) * i);
+		v->cell++;
+		v->front++;
+	} else {
+		memmove (&v->cell[i], &v->cell[i+1],
+			sizeof(lval*) * (v->count - i - 1));
+	}
+
+	/* Decrease the count of items in the list */
+	v->count--;
+
+	/* Decrease the memory used */
+	if (v->count == 0)
+		lval_cells_resize (v, 0);
+	else if (v->cap > LCELLS_SHRINK_MIN && v->count < v->cap / 4)
+		lval_cells_resize (v, v->count * 2);
+	return x;
+}
+
+lval *lval_conj (lval *x, lval *y)
+{
+	x = lval_unshare (x);
+
+	/* Move the cells of y over in one go, or share them if y is shared */
+	if (y->refs > 1) {
+		lval_reserve (x, x->count + y->count);
+		for (int i = 0; i < y->count; i++)
+			x = lval_add (x, lval_copy (y->cell[i]));
+	} else {
+		x = lval_add_all (x, y->cell, y->count);
+		y->count = 0;
+	}
+	lval_del(y);
+	return x;
+}
+
+lval *lval_take (lval *v, int i)
+{
+	/* Leave shared lists intact */
+	if (v->refs > 1) {
+		lval *x = lval_copy (v->cell[i]);
+		lval_del (v);
+		return x;
+	}
+
+	lval *x = lval_pop (v, i);
+	lval_del (v);
+	return x;
+}
+
+/* v as a vector if it is a Q-Expression of only longs or only doubles,
+   else v as it is */
+lval *lvec_pack (lval *v)
+{
+	if (lval_type (v) != LVAL_QEXPR || v->count == 0)
+		return v;
+
+	int elem = lval_type (v->cell[0]);
+	if (elem != LVAL_NUM && elem != LVAL_DBL)
+		return v;
+	for (int i = 0; i < v->count; i++) {
+		if (lval_type (v->cell[i]) != elem || lval_is_big (v->cell[i]))
+			return v;
+	}
+
+	lval *x = lval_vec (elem, v->count);
+	for (int i = 0; i < v->count; i++) {
+		if (elem == LVAL_DBL)
+			lvec_dbls (x)[i] = lval_double (v->cell[i]);
+		else
+			lvec_ints (x)[i] = lval_number (v->cell[i]);
+	}
+	lval_del (v);
+	return x;
+}
+
+/* v as a Q-Expression of cells, for code that knows nothing else */
+lval *lvec_unpack (lval *v)
+{
+	if (lval_type (v) != LVAL_VEC)
+		return v;
+
+	lval *x = lval_reserve (lval_qexpr (), v->count);
+	for (int i = 0; i < v->count; i++)
+		x->cell[i] = lvec_get (v, i);
+	x->count = v->count;
+	lval_del (v);
+	return x;
+}
+
+static lrrb *lrrb_new (int height)
+{
+	/* Nodes follow the lvals they are built for into the line arena */
+	size_t size = sizeof(lrrb) + (height ? sizeof(int) * LRRB_M : 0);
+	lrrb *n = lalloc.arena_on ? larena_alloc (size) : malloc (size);
+	n->arena = lalloc.arena_on;
+	n->refs = 1;
+	n->height = height;
+	n->count = 0;
+	n->sizes = height ? (int*) (n + 1) : NULL;
+	return n;
+}
+
+static int lrrb_size (lrrb *n)
+{
+	return n->height ? n->sizes[n->count - 1] : n->count;
+}
+
+static void lrrb_unref (lrrb *n)
+{
+	if (--n->refs > 0)
+		return;
+	for (int i = 0; i < n->count; i++) {
+		if (n->height)
+			lrrb_unref (n->slot[i]);
+		else
+			lval_del (n->slot[i]);
+	}
+	if (!n->arena)
+		free (n);
+}
+
+/* Append the child or item c to n, taking over its reference */
+static void lrrb_push (lrrb *n, void *c)
+{
+	if (n->height)
+		n->sizes[n->count] = (n->count ? n->sizes[n->count - 1] : 0)
+				     + lrrb_size (c);
+	n->slot[n->count++] = c;
+}
+
+/* Another reference to slot i of n */
+static void *lrrb_slot (lrrb *n, int i)
+{
+	if (n->height == 0)
+		return lval_copy (n->slot[i]);
+	((lrrb*) n->slot[i])->refs++;
+	return n->slot[i];
+}
+
+/* Item i of the tree n */
+static lval *lrrb_get (lrrb *n, int i)
+{
+	while (n->height) {
+		int c = 0;
+		while (n->sizes[c] <= i)
+			c++;
+		if (c)
+			i -= n->sizes[c - 1];
+		n = n->slot[c];
+	}
+	return n->slot[i];
+}
+
+/* Borrowed pointers to the items of n, in order, from out on */
+static lval **lrrb_items (lrrb *n, lval **out)
+{
+	for (int i = 0; i < n->count; i++) {
+		if (n->height)
+			out = lrrb_items (n->slot[i], out);
+		else
+			*out++ = n->slot[i];
+	}
+	return out;
+}
+
+/* Tree of the n items at cell, full leaves under full nodes */
+static lrrb *lrrb_build (lval **cell, int n)
+{
+	int m = (n + LRRB_M - 1) / LRRB_M;
+	lrrb **level = malloc (sizeof(lrrb*) * m);
+	for (int i = 0; i < m; i++) {
+		level[i] = lrrb_new (0);
+		for (int j = i * LRRB_M; j < n && j < (i + 1) * LRRB_M; j++)
+			lrrb_push (level[i], lval_copy (cell[j]));
+	}
+
+	for (int h = 1; m > 1; h++) {
+		int k = (m + LRRB_M - 1) / LRRB_M;
+		for (int i = 0; i < k; i++) {
+			lrrb *p = lrrb_new (h);
+			for (int j = i * LRRB_M; j < m && j < (i + 1) * LRRB_M; j++)
+				lrrb_push (p, level[j]);
+			level[i] = p;
+		}
+		m = k;
+	}
+
+	lrrb *root = level[0];
+	free (level);
+	return root;
+}
+
+/* Items lo..hi of n, lo < hi, as a tree of the same height sharing the
+   children that lie wholly inside */
+static lrrb *lrrb_slice (lrrb *n, int lo, int hi)
+{
+	if (lo == 0 && hi == lrrb_size (n)) {
+		n->refs++;
+		return n;
+	}
+
+	lrrb *x = lrrb_new (n->height);
+	if (n->height == 0) {
+		for (int i = lo; i < hi; i++)
+			lrrb_push (x, lval_copy (n->slot[i]));
+		return x;
+	}
+
+	int start = 0;
+	for (int c = 0; c < n->count && start < hi; c++) {
+		int end = n->sizes[c];
+		if (end > lo)
+			lrrb_push (x, lrrb_slice (n->slot[c],
+						  lo > start ? lo - start : 0,
+						  (hi < end ? hi : end) - start));
+		start = end;
+	}
+	return x;
+}
+
+/* Node of the given height over the n children or items at c, or over
+   two halves of them one level up if they are too many for one */
+static lrrb *lrrb_node_of (int height, void **c, int n)
+{
+	if (n > LRRB_M) {
+		lrrb *p = lrrb_new (height + 1);
+		lrrb_push (p, lrrb_node_of (height, c, n / 2));
+		lrrb_push (p, lrrb_node_of (height, c + n / 2, n - n / 2));
+		return p;
+	}
+	lrrb *x = lrrb_new (height);
+	for (int i = 0; i < n; i++)
+		lrrb_push (x, c[i]);
+	return x;
+}
+
+/* a followed by b, taking over both references. The result is a level
+   taller than the taller of them when the edge where they meet does not
+   fit in that height */
+static lrrb *lrrb_join (lrrb *a, lrrb *b)
+{
+	void *c[LRRB_M * 2];
+	int n = 0;
+	int height = a->height > b->height ? a->height : b->height;
+
+	if (a->height == b->height) {
+		/* Side by side, or merged if they fit in one */
+		if (a->count + b->count > LRRB_M) {
+			lrrb *p = lrrb_new (height + 1);
+			lrrb_push (p, a);
+			lrrb_push (p, b);
+			return p;
+		}
+		for (int i = 0; i < a->count; i++)
+			c[n++] = lrrb_slot (a, i);
+		for (int i = 0; i < b->count; i++)
+			c[n++] = lrrb_slot (b, i);
+		lrrb_unref (a);
+		lrrb_unref (b);
+	} else if (a->height > b->height) {
+		/* b goes down the right edge of a */
+		for (int i = 0; i < a->count - 1; i++)
+			c[n++] = lrrb_slot (a, i);
+		lrrb *r = lrrb_join (lrrb_slot (a, a->count - 1), b);
+		if (r->height < height) {
+			c[n++] = r;
+		} else {
+			c[n++] = lrrb_slot (r, 0);
+			c[n++] = lrrb_slot (r, 1);
+			lrrb_unref (r);
+		}
+		lrrb_unref (a);
+	} else {
+		/* a goes down the left edge of b */
+		lrrb *r = lrrb_join (a, lrrb_slot (b, 0));
+		if (r->height < height) {
+			c[n++] = r;
+		} else {
+			c[n++] = lrrb_slot (r, 0);
+			c[n++] = lrrb_slot (r, 1);
+			lrrb_unref (r);
+		}
+		for (int i = 1; i < b->count; i++)
+			c[n++] = lrrb_slot (b, i);
+		lrrb_unref (b);
+	}
+	return lrrb_node_of (height, c, n);
+}
+
+/* n with a node of its own to change, copying it if it is shared or
+   outside the line arena while that is on */
+static lrrb *lrrb_own (lrrb *n)
+{
+	if (n->refs == 1 && n->arena == lalloc.arena_on)
+		return n;
+	lrrb *x = lrrb_new (n->height);
+	for (int i = 0; i < n->count; i++)
+		lrrb_push (x, lrrb_slot (n, i));
+	lrrb_unref (n);
+	return x;
+}
+
+/* A lone item under nodes down to the given height */
+static lrrb *lrrb_spine (int height, lval *item)
+{
+	lrrb *x = lrrb_new (0);
+	lrrb_push (x, item);
+	for (int h = 1; h <= height; h++) {
+		lrrb *p = lrrb_new (h);
+		lrrb_push (p, x);
+		x = p;
+	}
+	return x;
+}
+
+/* Add item at the right edge of the owned node n, 0 if n is full */
+static int lrrb_append_in (lrrb *n, lval *item)
+{
+	if (n->height == 0) {
+		if (n->count == LRRB_M)
+			return 0;
+		lrrb_push (n, item);
+		return 1;
+	}
+	lrrb *last = lrrb_own (n->slot[n->count - 1]);
+	n->slot[n->count - 1] = last;
+	if (lrrb_append_in (last, item)) {
+		n->sizes[n->count - 1]++;
+		return 1;
+	}
+	if (n->count == LRRB_M)
+		return 0;
+	lrrb_push (n, lrrb_spine (n->height - 1, item));
+	return 1;
+}
+
+/* n followed by item, taking over both. Only the right edge is copied,
+   and not even that when n is not shared */
+static lrrb *lrrb_append (lrrb *n, lval *item)
+{
+	n = lrrb_own (n);
+	if (lrrb_append_in (n, item))
+		return n;
+	lrrb *p = lrrb_new (n->height + 1);
+	lrrb_push (p, n);
+	lrrb_push (p, lrrb_spine (n->height, item));
+	return p;
+}
+
+/* New list holding the tree n, or its items if they are too few */
+lval *lval_rrb (lrrb *n)
+{
+	/* Slices leave spines of single children at the top */
+	while (n->height && n->count == 1) {
+		lrrb *c = lrrb_slot (n, 0);
+		lrrb_unref (n);
+		n = c;
+	}
+
+	int size = lrrb_size (n);
+	if (size < LRRB_MIN) {
+		lval *x = lval_reserve (lval_qexpr (), size);
+		lrrb_items (n, x->cell);
+		for (int i = 0; i < size; i++)
+			x->cell[i] = lval_copy (x->cell[i]);
+		x->count = size;
+		lrrb_unref (n);
+		return x;
+	}
+
+	lval *v = lval_alloc ();
+	v->type = LVAL_RRB;
+	v->rrb = n;
+	v->count = size;
+	return v;
+}
+
+/* v as a tree if it is a Q-Expression long enough to be one */
+lval *lrrb_pack (lval *v)
+{
+	if (lval_type (v) != LVAL_QEXPR || v->count < LRRB_MIN)
+		return v;
+	lval *x = lval_rrb (lrrb_build (v->cell, v->count));
+	lval_del (v);
+	return x;
+}
+
+/* v as a Q-Expression of cells */
+lval *lrrb_unpack (lval *v)
+{
+	if (lval_type (v) != LVAL_RRB)
+		return v;
+
+	lval *x = lval_reserve (lval_qexpr (), v->count);
+	lrrb_items (v->rrb, x->cell);
+	for (int i = 0; i < v->count; i++)
+		x->cell[i] = lval_copy (x->cell[i]);
+	x->count = v->count;
+	lval_del (v);
+	return x;
+}
+
+lfree *lcons_heap;
+
+static lcons *lcons_new (void)
+{
+	if (lalloc.arena_on) {
+		lcons *r = larena_alloc (sizeof(lcons));
+		r->arena = 1;
+		r->refs = 1;
+		r->lo = LCONS_RUN;
+		r->cdr = NULL;
+		r->cdr_at = 0;
+		return r;
+	}
+
+	if (lcons_heap == NULL) {
+		lcons *slab = lalloc_sys (sizeof(lcons) * LALLOC_SLAB);
+		for (int i = 0; i < LALLOC_SLAB; i++) {
+			lfree *f = (lfree*) &slab[i];
+			f->next = lcons_heap;
+			lcons_heap = f;
+		}
+	}
+	lcons *r = (lcons*) lcons_heap;
+	lcons_heap = lcons_heap->next;
+	r->arena = 0;
+	r->refs = 1;
+	r->lo = LCONS_RUN;
+	r->cdr = NULL;
+	r->cdr_at = 0;
+	return r;
+}
+
+/* Drop a reference to r, and runs after it that are left unused */
+static void lcons_unref (lcons *r)
+{
+	while (r && --r->refs == 0) {
+		for (int i = r->lo; i < (int) LCONS_RUN; i++)
+			lval_del (r->car[i]);
+		lcons *cdr = r->cdr;
+		if (!r->arena) {
+			lfree *f = (lfree*) r;
+			f->next = lcons_heap;
+			lcons_heap = f;
+		}
+		r = cdr;
+	}
+}
+
+/* x in front of the list at slot *at of r, taking over x and a reference
+   to r, which may be NULL for the empty list */
+static lcons *lcons_push (lcons *r, int *at, lval *x)
+{
+	/* Runs outside the line arena take nothing from inside it */
+	if (r && *at == r->lo && r->lo > 0 && r->arena == lalloc.arena_on) {
+		r->car[--r->lo] = x;
+		--*at;
+		return r;
+	}
+	lcons *n = lcons_new ();
+	n->car[--n->lo] = x;
+	n->cdr = r;
+	n->cdr_at = *at;
+	*at = n->lo;
+	return n;
+}
+
+/* The car at slot *at of *r, moving both on to the cdr */
+static lval *lcons_next (lcons **r, int *at)
+{
+	lval *x = (*r)->car[*at];
+	if (++*at == (int) LCONS_RUN) {
+		*at = (*r)->cdr_at;
+		*r = (*r)->cdr;
+	}
+	return x;
+}
+
+/* Borrowed pointers to the n items of the list v, in order, at out */
+static void lcons_items (lval *v, lval **out)
+{
+	lcons *r = v->cons;
+	int at = v->front;
+	for (int i = 0; i < v->count; i++)
+		out[i] = lcons_next (&r, &at);
+}
+
+/* New list of the n items from slot at of r on, taking over a reference
+   to r */
+lval *lval_cons (lcons *r, int at, int n)
+{
+	if (n == 0) {
+		lcons_unref (r);
+		return lval_qexpr ();
+	}
+	lval *v = lval_alloc ();
+	v->type = LVAL_CONS;
+	v->cons = r;
+	v->front = at;
+	v->count = n;
+	return v;
+}
+
+/* The n items at cell consed in front of slot *at of r */
+static lcons *lcons_push_all (lcons *r, int *at, lval **cell, int n)
+{
+	for (int i = n - 1; i >= 0; i--)
+		r = lcons_push (r, at, lval_copy (cell[i]));
+	return r;
+}
+
+/* v as a cons list if it is a Q-Expression */
+lval *lcons_pack (lval *v)
+{
+	if (lval_type (v) != LVAL_QEXPR || v->count == 0)
+		return v;
+	int at = 0;
+	lcons *r = lcons_push_all (NULL, &at, v->cell, v->count);
+	lval *x = lval_cons (r, at, v->count);
+	lval_del (v);
+	return x;
+}
+
+/* v as a Q-Expression of cells */
+lval *lcons_unpack (lval *v)
+{
+	if (lval_type (v) != LVAL_CONS)
+		return v;
+
+	lval *x = lval_reserve (lval_qexpr (), v->count);
+	lcons_items (v, x->cell);
+	for (int i = 0; i < v->count; i++)
+		x->cell[i] = lval_copy (x->cell[i]);
+	x->count = v->count;
+	lval_del (v);
+	return x;
+}
+
+/* The tree holding the items of any list v, taking over v */
+static lrrb *lrrb_of (lval *v)
+{
+	if (lval_type (v) == LVAL_RRB) {
+		lrrb *n = v->rrb;
+		n->refs++;
+		lval_del (v);
+		return n;
+	}
+	v = lcons_unpack (lvec_unpack (v));
+	lrrb *n = lrrb_build (v->cell, v->count);
+	lval_del (v);
+	return n;
+}
+
+/* The list v in whichever form suits it best */
+lval *lval_pack (lval *v)
+{
+	v = lvec_pack (v);
+	return LEZ_CONS ? lcons_pack (v) : lrrb_pack (v);
+}
+
+/* v as a Q-Expression of cells, for code that knows nothing else */
+lval *lval_unpack (lval *v)
+{
+	return lcons_unpack (lrrb_unpack (lvec_unpack (v)));
+}
+
+/* Print x so that it reads back as the same double */
+static void lval_print_dbl (double x)
+{
+	char buf[32];
+	for (int digits = 15; digits <= 17; digits++) {
+		snprintf (buf, sizeof(buf), "%.*g", digits, x);
+		if (strtod (buf, NULL) == x)
+			break;
+	}
+	/* Whole numbers still need a point to stay doubles; inf and nan
+	   have no syntax anyway */
+	if (!strpbrk (buf, ".en"))
+		strcat (buf, ".0");
+	fputs (buf, stdout);
+}
+
+void lval_vec_print (lval *v)
+{
+	putchar ('{');
+	for (int i = 0; i < v->count; i++) {
+		if (i > 0)
+			putchar (' ');
+		if (v->elem == LVAL_DBL)
+			lval_print_dbl (lvec_dbls (v)[i]);
+		else
+			printf ("%li", lvec_ints (v)[i]);
+	}
+	putchar ('}');
+}
+
+/* Print an lval that is not a list */
+static void lval_print_atom (lval *v)
+{
+	switch (lval_type (v)) {
+	case LVAL_NUM:
+		if (lval_is_big (v))
+			lbig_print (v->big);
+		else
+			printf ("%li", lval_number (v));
+		break;
+	case LVAL_DBL:
+		lval_print_dbl (lval_double (v));
+		break;
+	case LVAL_ERR:
+		printf ("Error: %s", v->err);
+		break;
+	case LVAL_SYM:
+		printf ("%s", v->sym);
+		break;
+	case LVAL_VEC:
+		lval_vec_print (v);
+		break;
+  case LVAL_FUN:
+    printf("<function>");
+    break;
+	}
+}
+
+/* A list being printed: its items, the next one to print and the byte
+   that closes it */
+typedef struct {
+	lval **items;
+	int count, next;
+	char close;
+	int gathered;    /* items were copied out of a tree or cons runs */
+} lprint_open;
+
+/* Print an lval. The lists still open wait on a stack of their own, so
+   nesting takes no C stack */
+void lval_print (lval *v)
+{
+	lprint_open *open = NULL;
+	int depth = 0, cap = 0;
+
+	for (;;) {
+		int t = lval_type (v);
+		if (t == LVAL_SEXPR || t == LVAL_QEXPR || t == LVAL_RRB
+		    || t == LVAL_CONS) {
+			if (depth == cap) {
+				cap = cap ? cap * 2 : 16;
+				open = realloc (open, sizeof(lprint_open) * cap);
+			}
+			lprint_open *l = &open[depth++];
+			l->count = v->count;
+			l->next = 0;
+			l->close = t == LVAL_SEXPR ? ')' : '}';
+			l->gathered = t == LVAL_RRB || t == LVAL_CONS;
+			if (t == LVAL_CONS) {
+				l->items = malloc (sizeof(lval*) * v->count);
+				lcons_items (v, l->items);
+			} else if (t == LVAL_RRB) {
+				l->items = malloc (sizeof(lval*) * v->count);
+				lrrb_items (v->rrb, l->items);
+			} else {
+				l->items = v->cell;
+			}
+			putchar (t == LVAL_SEXPR ? '(' : '{');
+		} else {
+			lval_print_atom (v);
+		}
+
+		/* Close the lists that are done, then go on with the next item */
+		while (depth > 0 && open[depth - 1].next == open[depth - 1].count) {
+			lprint_open *l = &open[--depth];
+			putchar (l->close);
+			if (l->gathered)
+				free (l->items);
+		}
+		if (depth == 0)
+			break;
+		lprint_open *l = &open[depth - 1];
+		if (l->next > 0)
+			putchar (' ');
+		v = l->items[l->next++];
+	}
+	free (open);
+}
+
+void lval_println (lval *v)
+{
+	lval_print (v);
+	putchar ('\n');
+}
+
+
+#define LASSERT(args, cond, err) \
+	if (!(cond)) { lval_del (args); return lval_err (err); }
+
+lval *lval_eval (lenv *e, lval *v);
+
+/* Fold constant calls before evaluating them, set by --fold */
+int lfold = 0;
+
+/* Return S-Expression transformed to Q-expression (builds a list) */
+lval *builtin_list (lenv *e, lval *a)
+{
+	a = lval_unshare (a);
+	a->type = LVAL_QEXPR;
+	return lval_pack (a);
+}
+
+/* Return the head(first) element of the list CAR */
+lval *builtin_first (lenv *e, lval *a)
+{
+	LASSERT (a, a->cell[0]->count != 0,
+		 "Function 'first' passed {}.");
+
+	lval *v = lval_take (a, 0);
+
+	if (lval_type (v) == LVAL_VEC) {
+		lval *x = v;
+		if (v->refs > 1) {
+			x = lval_vec (v->elem, 0);
+			lvec_view (x, v, 0, 1);
+			lval_del (v);
+		} else {
+			x->count = 1;
+			lvec_resize (x, 1);
+		}
+		return x;
+	}
+
+	if (lval_type (v) == LVAL_RRB) {
+		lval *x = lval_qexpr ();
+		x = lval_add (x, lval_copy (lrrb_get (v->rrb, 0)));
+		lval_del (v);
+		return x;
+	}
+
+	if (lval_type (v) == LVAL_CONS) {
+		lval *x = lval_qexpr ();
+		x = lval_add (x, lval_copy (v->cons->car[v->front]));
+		lval_del (v);
+		return x;
+	}
+
+	/* Shared list, build the result rather than trim it */
+	if (v->refs > 1) {
+		lval *x = lval_add (lval_qexpr (), lval_copy (v->cell[0]));
+		lval_del (v);
+		return x;
+	}
+
+	/* Drop the tail in one go */
+	for (int i = 1; i < v->count; i++)
+		lval_del (v->cell[i]);
+	v->count = 1;
+	lval_cells_resize (v, 1);
+
+	return v;
+}
+
+/* Return the list minus the first element (tail) CDR */
+lval *builtin_rest (lenv *e, lval *a)
+{
+	LASSERT (a, a->cell[0]->count != 0,
+		 "Function 'rest' passed {}.");
+
+	lval *v = lval_take (a, 0);
+
+	/* Vectors skip their head, a shared one by sharing its block */
+	if (lval_type (v) == LVAL_VEC) {
+		if (v->refs > 1) {
+			lval *x = lval_vec (v->elem, 0);
+			lvec_view (x, v, 1, v->count - 1);
+			lval_del (v);
+			return x;
+		}
+		v->front++;
+		v->count--;
+		if (v->count == 0
+		    || (v->cap > LCELLS_SHRINK_MIN && v->count < v->cap / 4))
+			lvec_resize (v, v->count * 2);
+		return v;
+	}
+
+	/* Trees share all but the left edge with the rest */
+	if (lval_type (v) == LVAL_RRB) {
+		lval *x = lval_rrb (lrrb_slice (v->rrb, 1, v->count));
+		lval_del (v);
+		return x;
+	}
+
+	/* Cons lists are their rest with a car in front */
+	if (lval_type (v) == LVAL_CONS) {
+		lcons *r = v->cons;
+		int at = v->front;
+		lcons_next (&r, &at);
+		if (r)
+			r->refs++;
+		lval *x = lval_cons (r, at, v->count - 1);
+		lval_del (v);
+		return x;
+	}
+
+	/* Shared list, build the result rather than trim it */
+	if (v->refs > 1) {
+		lval *x = lval_qexpr ();
+		for (int i = 1; i < v->count; i++)
+			x = lval_add (x, lval_copy (v->cell[i]));
+		lval_del (v);
+		return x;
+	}
+
+	lval_del (lval_pop (v, 0));
+	return v;
+}
+
+/* Return the list with x in front of it */
+lval *builtin_cons (lenv *e, lval *a)
+{
+	LASSERT (a, LTYPE(lval_type (a->cell[1])) & LTYPE_LIST,
+		 "Function 'cons' passed incorrect types.");
+
+	a = lval_unshare (a);
+	lval *x = lval_pop (a, 0);
+	lval *v = lval_take (a, 0);
+
+	if (lval_type (v) == LVAL_CONS) {
+		lcons *r = v->cons;
+		int at = v->front;
+		r->refs++;
+		r = lcons_push (r, &at, x);
+		lval *y = lval_cons (r, at, v->count + 1);
+		lval_del (v);
+		return y;
+	}
+
+	if (lval_type (v) == LVAL_RRB)
+		return lval_rrb (lrrb_join (lrrb_spine (0, x), lrrb_of (v)));
+
+	v = lval_unpack (v);
+	lval *y = lval_reserve (lval_qexpr (), v->count + 1);
+	y = lval_add (y, x);
+	for (int i = 0; i < v->count; i++)
+		y = lval_add (y, lval_copy (v->cell[i]));
+	lval_del (v);
+	return lval_pack (y);
+}
+
+/* Return a S-Expression from a Q-Expression and evaluates it */
+lval *builtin_eval (lenv *e, lval *a)
+{
+	lval *x = lval_unshare (lval_unpack (lval_take(a, 0)));
+	x->type = LVAL_SEXPR;
+	return lval_eval (e, x);
+}
+
+/* The vectors among the lists of a joined into one */
+static lval *lvec_conj (lval *a)
+{
+	int n = 0;
+	int first = -1;
+	for (int i = 0; i < a->count; i++) {
+		n += a->cell[i]->count;
+		if (first < 0 && lval_type (a->cell[i]) == LVAL_VEC)
+			first = i;
+	}
+
+	/* Append to the first vector, in place if its block is its own */
+	lval *x = lval_unshare (lval_pop (a, first));
+	size_t w = lvec_width (x);
+	if (x->pack == NULL || lvec_users (x) > 1 || x->front + n > x->cap)
+		lvec_resize (x, n);
+	for (int i = 0; i < a->count; i++) {
+		lval *v = a->cell[i];
+		if (v->count == 0)
+			continue;
+		memcpy ((char*) lvec_ints (x) + x->count * w, lvec_ints (v),
+			v->count * w);
+		x->count += v->count;
+	}
+	lval_del (a);
+	return x;
+}
+
+/* The lists of a joined into one tree */
+static lval *lrrb_conj (lval *a)
+{
+	lrrb *x = NULL;
+	while (a->count) {
+		lval *v = lval_pop (a, 0);
+		if (v->count == 0) {
+			lval_del (v);
+			continue;
+		}
+		/* A few items go on one at a time, more are a tree of their own */
+		if (x && lval_type (v) != LVAL_RRB && v->count < LRRB_M) {
+			v = lval_unpack (v);
+			for (int i = 0; i < v->count; i++)
+				x = lrrb_append (x, lval_copy (v->cell[i]));
+			lval_del (v);
+			continue;
+		}
+		lrrb *n = lrrb_of (v);
+		x = x ? lrrb_join (x, n) : n;
+	}
+	lval_del (a);
+	return lval_rrb (x);
+}
+
+/* The lists of a joined into one cons list, sharing the last one */
+static lval *lcons_conj (lval *a)
+{
+	lcons *r = NULL;
+	int at = 0;
+	int n = 0;
+	for (int i = a->count - 1; i >= 0; i--) {
+		lval *v = a->cell[i];
+		if (r == NULL && lval_type (v) == LVAL_CONS) {
+			r = v->cons;
+			r->refs++;
+			at = v->front;
+		} else {
+			v = a->cell[i] = lval_unpack (v);
+			r = lcons_push_all (r, &at, v->cell, v->count);
+		}
+		n += v->count;
+	}
+	lval_del (a);
+	return lval_cons (r, at, n);
+}
+
+/* Return a joint Q-Expression from N Q-Expression in input */
+lval *builtin_conj (lenv *e, lval *a)
+{
+	/* Vectors of one type join by copying their numbers, empty lists
+	   add nothing */
+	int elem = -1;
+	int packed = 1;
+	for (int i = 0; i < a->count && packed; i++) {
+		lval *v = a->cell[i];
+		if (lval_type (v) == LVAL_VEC && (elem < 0 || elem == v->elem))
+			elem = v->elem;
+		else if (v->count != 0)
+			packed = 0;
+	}
+	if (packed && elem >= 0)
+		return lvec_conj (a);
+
+	/* Long lists and trees join as trees */
+	int n = 0;
+	int trees = 0;
+	int conses = LEZ_CONS;
+	for (int i = 0; i < a->count; i++) {
+		n += a->cell[i]->count;
+		trees |= lval_type (a->cell[i]) == LVAL_RRB;
+		conses |= lval_type (a->cell[i]) == LVAL_CONS;
+	}
+	if (conses)
+		return lcons_conj (a);
+	if (trees || n >= LRRB_MIN)
+		return lrrb_conj (a);
+
+	for (int i = 0; i < a->count; i++)
+		a->cell[i] = lvec_unpack (a->cell[i]);
+
+	/* Size the result once */
+	lval *x = lval_unshare (lval_pop (a, 0));
+	lval_reserve (x, n);
+
+  /* For each cell in y add it to x */
+	while (a->count) {
+		x = lval_conj (x, lval_pop (a, 0));
+	}
+
+	lval_del (a);
+
+	return x;
+}
+
+/* Arithmetic kernels
+ *
+ * Each operator has its own kernel folding the whole contiguous argument
+ * array into one result; builtin_op then frees the arguments in one go.
+ * The fast paths work on longs and hand over to a checked fold that goes
+ * on in a bignum as soon as a step would overflow, or an argument is
+ * one already. Addition and subtraction decode fixnums four (AVX2) or
+ * two (SSE2) at a time when every argument is an immediate.
+ */
+typedef lval *(*lkernel)(lval **cell, int n);
+
+
+#if UINTPTR_MAX == 0xffffffffffffffffu
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LSIMD_LANES 4
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LSIMD_LANES 2
+#endif
+#endif
+
+/* *r = x + y, x - y and x * y unless they overflow */
+static inline int ladd_ok (long x, long y, long *r)
+{
+	if ((y > 0 && x > LONG_MAX - y) || (y < 0 && x < LONG_MIN - y))
+		return 0;
+	*r = x + y;
+	return 1;
+}
+
+static inline int lsub_ok (long x, long y, long *r)
+{
+	if ((y < 0 && x > LONG_MAX + y) || (y > 0 && x < LONG_MIN + y))
+		return 0;
+	*r = x - y;
+	return 1;
+}
+
+static inline int lmul_ok (long x, long y, long *r)
+{
+#if defined(__GNUC__)
+	long t;
+	if (__builtin_mul_overflow (x, y, &t))
+		return 0;
+	*r = t;
+	return 1;
+#else
+	if (x > 0 ? (y > 0 ? x > LONG_MAX / y : y < LONG_MIN / x)
+		  : (y > 0 ? x < LONG_MIN / y : x != 0 && y < LONG_MAX / x))
+		return 0;
+	*r = x * y;
+	return 1;
+#endif
+}
+
+/* Sum of the numbers in cell[0..n) into *sum, if they are all fixnums
+   small enough for no partial sum to overflow */
+static int lsum (lval **cell, int n, long *sum)
+{
+	int i = 0;
+	unsigned long s = 0;
+	uintptr_t tags = ~(uintptr_t) 0;
+	/* Or of t ^ (t << 1), above its top bit every number is all sign */
+	uintptr_t bits = 0;
+
+#if LSIMD_LANES == 4
+	__m256i vsum = _mm256_setzero_si256 ();
+	__m256i vtag = _mm256_set1_epi64x (-1);
+	__m256i vbits = _mm256_setzero_si256 ();
+	__m256i sign = _mm256_set1_epi64x (INT64_MIN);
+	for (; i + 4 <= n; i += 4) {
+		__m256i t = _mm256_loadu_si256 ((__m256i*) &cell[i]);
+		/* Arithmetic shift right by one, undoing the tag */
+		__m256i x = _mm256_or_si256 (_mm256_srli_epi64 (t, 1),
+					     _mm256_and_si256 (t, sign));
+		vtag = _mm256_and_si256 (vtag, t);
+		vbits = _mm256_or_si256 (vbits, _mm256_xor_si256 (t,
+					 _mm256_slli_epi64 (t, 1)));
+		vsum = _mm256_add_epi64 (vsum, x);
+	}
+	uint64_t v[4], t[4], b[4];
+	_mm256_storeu_si256 ((__m256i*) v, vsum);
+	_mm256_storeu_si256 ((__m256i*) t, vtag);
+	_mm256_storeu_si256 ((__m256i*) b, vbits);
+	s = v[0] + v[1] + v[2] + v[3];
+	tags = t[0] & t[1] & t[2] & t[3];
+	bits = b[0] | b[1] | b[2] | b[3];
+#elif LSIMD_LANES == 2
+	__m128i vsum = _mm_setzero_si128 ();
+	__m128i vtag = _mm_set1_epi32 (-1);
+	__m128i vbits = _mm_setzero_si128 ();
+	__m128i sign = _mm_set_epi32 (INT32_MIN, 0, INT32_MIN, 0);
+	for (; i + 2 <= n; i += 2) {
+		__m128i t = _mm_loadu_si128 ((__m128i*) &cell[i]);
+		/* Arithmetic shift right by one, undoing the tag */
+		__m128i x = _mm_or_si128 (_mm_srli_epi64 (t, 1),
+					  _mm_and_si128 (t, sign));
+		vtag = _mm_and_si128 (vtag, t);
+		vbits = _mm_or_si128 (vbits, _mm_xor_si128 (t,
+				      _mm_slli_epi64 (t, 1)));
+		vsum = _mm_add_epi64 (vsum, x);
+	}
+	uint64_t v[2], t[2], b[2];
+	_mm_storeu_si128 ((__m128i*) v, vsum);
+	_mm_storeu_si128 ((__m128i*) t, vtag);
+	_mm_storeu_si128 ((__m128i*) b, vbits);
+	s = v[0] + v[1];
+	tags = t[0] & t[1];
+	bits = b[0] | b[1];
+#endif
+
+	for (; i < n; i++) {
+		uintptr_t t = (uintptr_t) cell[i];
+		tags &= t;
+		bits |= t ^ (t << 1);
+		s += (unsigned long) lval_fixnum_value (cell[i]);
+	}
+
+	/* A boxed number, leave it to the checked fold */
+	if (!(tags & 1))
+		return 0;
+
+	/* With bits below 2^p every number is within +-2^(p-2), n of them
+	   below 2^lg add up within +-2^(p-2+lg). Small numbers can't
+	   overflow whatever n is */
+	if (bits >> (sizeof(uintptr_t) * CHAR_BIT - 30)) {
+		int lg = 0;
+		while (lg < 31 && (n >> lg))
+			lg++;
+		if (lg > 1 && bits >> (sizeof(uintptr_t) * CHAR_BIT + 1 - lg))
+			return 0;
+	}
+
+	*sum = (long) s;
+	return 1;
+}
+
+/* Mixed-mode arithmetic
+ *
+ * Once any argument is a double the whole operation is done in doubles.
+ * The arguments are unpacked into an array of doubles once, then folded by
+ * a loop per operator that no longer looks at their types. Only the slow
+ * folds below check for doubles, all-fixnum arithmetic never gets here.
+ * Lists among the arguments are worked through element by element by
+ * lvec_op, further down.
+ */
+static lval *lvec_op (lval **cell, int n, char op);
+
+/* LTYPE mask of the types in cell[0..n) */
+static int ltypes (lval **cell, int n)
+{
+	int t = 0;
+	for (int i = 0; i < n; i++)
+		t |= LTYPE(lval_type (cell[i]));
+	return t;
+}
+
+static double lbig_to_double (lbig *b)
+{
+	double x = 0.0;
+	for (int i = b->n - 1; i >= 0; i--)
+		x = x * 4294967296.0 + b->d[i];
+	return b->neg ? -x : x;
+}
+
+/* Value of the number v, of either type, as a double */
+static inline double lval_to_double (lval *v)
+{
+	if (lval_is_fixnum (v))
+		return (double) lval_fixnum_value (v);
+	if (lval_type (v) == LVAL_DBL)
+		return lval_double (v);
+	return v->big ? lbig_to_double (v->big) : (double) v->num;
+}
+
+/* Unpacked arguments up to this many stay on the C stack */
+#define LDBL_STACK 64
+
+/* op, one of + - * / %, folded left over cell[0..n) in doubles */
+static lval *lfold_dbl (lval **cell, int n, char op)
+{
+	double stack[LDBL_STACK];
+	double *d = n <= LDBL_STACK ? stack : malloc (sizeof(double) * n);
+	double r = lval_to_double (cell[0]);
+	for (int i = 1; i < n; i++)
+		d[i] = lval_to_double (cell[i]);
+
+	int i = 1;
+	switch (op) {
+	case '+':
+		for (; i < n; i++)
+			r += d[i];
+		break;
+	case '-':
+		if (n == 1)
+			r = -r;
+		for (; i < n; i++)
+			r -= d[i];
+		break;
+	case '*':
+		for (; i < n; i++)
+			r *= d[i];
+		break;
+	case '/':
+		for (; i < n && d[i] != 0.0; i++)
+			r /= d[i];
+		break;
+	case '%':
+		for (; i < n && d[i] != 0.0; i++)
+			r = fmod (r, d[i]);
+		break;
+	}
+
+	if (d != stack)
+		free (d);
+	/* Only division stops early, on a zero divisor */
+	if (i < n)
+		return lval_err ("Division by zero.");
+	return lval_dbl (r);
+}
+
+/* cell[0] + cell[1] + ..., or cell[0] - cell[1] - ... when sub, one
+   step at a time in a long until it overflows, then in a bignum */
+static lval *lfold_addsub (lval **cell, int n, int sub)
+{
+	int t = ltypes (cell, n);
+	if (t & LTYPE_LIST)
+		return lvec_op (cell, n, sub ? '-' : '+');
+	if (t & LTYPE(LVAL_DBL))
+		return lfold_dbl (cell, n, sub ? '-' : '+');
+
+	long s = 0;
+	lbig *b = NULL;
+
+	for (int i = 0; i < n; i++) {
+		/* A lone argument of - is negated */
+		int neg = sub && (i > 0 || n == 1);
+		if (b == NULL && !lval_is_big (cell[i])) {
+			long x = lval_number (cell[i]);
+			if (neg ? lsub_ok (s, x, &s) : ladd_ok (s, x, &s))
+				continue;
+		}
+		if (b == NULL)
+			b = lbig_from_long (s);
+		lbig *y = lval_to_big (cell[i]);
+		lbig *r = lbig_add (b, y, neg);
+		free (b);
+		free (y);
+		b = r;
+	}
+	return b ? lval_from_big (b) : lval_num (s);
+}
+
+static lval *lfold_mul (lval **cell, int n)
+{
+	int t = ltypes (cell, n);
+	if (t & LTYPE_LIST)
+		return lvec_op (cell, n, '*');
+	if (t & LTYPE(LVAL_DBL))
+		return lfold_dbl (cell, n, '*');
+
+	long p = 1;
+	lbig *b = NULL;
+
+	for (int i = 0; i < n; i++) {
+		if (b == NULL && !lval_is_big (cell[i])
+		    && lmul_ok (p, lval_number (cell[i]), &p))
+			continue;
+		if (b == NULL)
+			b = lbig_from_long (p);
+		lbig *y = lval_to_big (cell[i]);
+		lbig *r = lbig_mul (b, y);
+		free (b);
+		free (y);
+		b = r;
+	}
+	return b ? lval_from_big (b) : lval_num (p);
+}
+
+static lval *lfold_divmod (lval **cell, int n, int mod)
+{
+	int t = ltypes (cell, n);
+	if (t & LTYPE_LIST)
+		return lvec_op (cell, n, mod ? '%' : '/');
+	if (t & LTYPE(LVAL_DBL))
+		return lfold_dbl (cell, n, mod ? '%' : '/');
+
+	lbig *x = lval_to_big (cell[0]);
+
+	for (int i = 1; i < n; i++) {
+		if (!lval_is_big (cell[i]) && lval_number (cell[i]) == 0) {
+			free (x);
+			return lval_err ("Division by zero.");
+		}
+		lbig *y = lval_to_big (cell[i]);
+		lbig *r = lbig_divmod (x, y, mod);
+		free (x);
+		free (y);
+		x = r;
+	}
+	return lval_from_big (x);
+}
+
+lval *lkernel_add (lval **cell, int n)
+{
+	long s;
+	/* Sums of doubles don't need to fail the fixnum path first */
+	if (lval_is_flonum (cell[0]))
+		return lfold_addsub (cell, n, 0);
+	if (lsum (cell, n, &s))
+		return lval_num (s);
+	return lfold_addsub (cell, n, 0);
+}
+
+lval *lkernel_sub (lval **cell, int n)
+{
+	long s, x;
+	if (n > 1 && lval_is_fixnum (cell[0]) && lsum (cell + 1, n - 1, &s)
+	    && lsub_ok (lval_fixnum_value (cell[0]), s, &x))
+		return lval_num (x);
+	return lfold_addsub (cell, n, 1);
+}
+
+lval *lkernel_mul (lval **cell, int n)
+{
+	if (lval_is_flonum (cell[0]))
+		return lfold_mul (cell, n);
+
+	/* Independent partial products keep the multiplier busy */
+	long p[4] = { 1, 1, 1, 1 };
+	uintptr_t tags = ~(uintptr_t) 0;
+	int ok = 1;
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		tags &= (uintptr_t) cell[i] & (uintptr_t) cell[i + 1]
+			& (uintptr_t) cell[i + 2] & (uintptr_t) cell[i + 3];
+		ok &= lmul_ok (p[0], lval_fixnum_value (cell[i]), &p[0]);
+		ok &= lmul_ok (p[1], lval_fixnum_value (cell[i + 1]), &p[1]);
+		ok &= lmul_ok (p[2], lval_fixnum_value (cell[i + 2]), &p[2]);
+		ok &= lmul_ok (p[3], lval_fixnum_value (cell[i + 3]), &p[3]);
+	}
+	for (; i < n; i++) {
+		tags &= (uintptr_t) cell[i];
+		ok &= lmul_ok (p[0], lval_fixnum_value (cell[i]), &p[0]);
+	}
+
+	/* Only fixnums and no overflow, else do it again the checked way.
+	   Anything else was read as garbage above and is ignored */
+	if (ok && (tags & 1) && lmul_ok (p[0], p[1], &p[0])
+	    && lmul_ok (p[2], p[3], &p[2]) && lmul_ok (p[0], p[2], &p[0]))
+		return lval_num (p[0]);
+	return lfold_mul (cell, n);
+}
+
+/* Bignums, doubles and lists, which the long fast paths leave to the
+   folds */
+static inline int lval_is_slow (lval *v)
+{
+	return !lval_is_fixnum (v) && (lval_type (v) != LVAL_NUM || v->big);
+}
+
+/* Division folds left, the first zero divisor is an error */
+static lval *lkernel_divmod (lval **cell, int n, int mod)
+{
+	if (lval_is_slow (cell[0]))
+		return lfold_divmod (cell, n, mod);
+
+	long x = lval_number (cell[0]);
+	for (int i = 1; i < n; i++) {
+		if (lval_is_slow (cell[i]))
+			return lfold_divmod (cell, n, mod);
+		long y = lval_number (cell[i]);
+		if (y == 0)
+			return lval_err ("Division by zero.");
+		/* LONG_MIN / -1 is one past LONG_MAX */
+		if (y == -1 && x == LONG_MIN)
+			return lfold_divmod (cell, n, mod);
+		x = mod ? x % y : x / y;
+	}
+	return lval_num (x);
+}
+
+lval *lkernel_div (lval **cell, int n)
+{
+	return lkernel_divmod (cell, n, 0);
+}
+
+lval *lkernel_mod (lval **cell, int n)
+{
+	return lkernel_divmod (cell, n, 1);
+}
+
+/* Elementwise arithmetic
+ *
+ * Lists given to an operator are worked through element by element, the
+ * numbers among the arguments apply to every element: (+ {1 2} 10) is
+ * {11 12}. When all of the lists are vectors the arguments are folded
+ * straight into the numbers of the result with no allocation per element,
+ * + and - four (AVX2) or two (SSE2) at a time, and * and / too on
+ * doubles. Anything else, an overflow, a zero divisor, a bignum or a list
+ * of cells, goes element by element through the scalar kernels, which
+ * know what to do about it.
+ */
+#if LSIMD_LANES == 4
+typedef __m256i lsimd_si;
+typedef __m256d lsimd_pd;
+#define lsimd_load_si(p)     _mm256_loadu_si256 ((__m256i*) (p))
+#define lsimd_store_si(p, x) _mm256_storeu_si256 ((__m256i*) (p), x)
+#define lsimd_set1_si        _mm256_set1_epi64x
+#define lsimd_zero_si        _mm256_setzero_si256
+#define lsimd_add_si         _mm256_add_epi64
+#define lsimd_sub_si         _mm256_sub_epi64
+#define lsimd_xor_si         _mm256_xor_si256
+#define lsimd_and_si         _mm256_and_si256
+#define lsimd_or_si          _mm256_or_si256
+#define lsimd_load_pd        _mm256_loadu_pd
+#define lsimd_store_pd       _mm256_storeu_pd
+#define lsimd_set1_pd        _mm256_set1_pd
+#define lsimd_add_pd         _mm256_add_pd
+#define lsimd_sub_pd         _mm256_sub_pd
+#define lsimd_mul_pd         _mm256_mul_pd
+#define lsimd_div_pd         _mm256_div_pd
+#elif LSIMD_LANES == 2
+typedef __m128i lsimd_si;
+typedef __m128d lsimd_pd;
+#define lsimd_load_si(p)     _mm_loadu_si128 ((__m128i*) (p))
+#define lsimd_store_si(p, x) _mm_storeu_si128 ((__m128i*) (p), x)
+#define lsimd_set1_si        _mm_set1_epi64x
+#define lsimd_zero_si        _mm_setzero_si128
+#define lsimd_add_si         _mm_add_epi64
+#define lsimd_sub_si         _mm_sub_epi64
+#define lsimd_xor_si         _mm_xor_si128
+#define lsimd_and_si         _mm_and_si128
+#define lsimd_or_si          _mm_or_si128
+#define lsimd_load_pd        _mm_loadu_pd
+#define lsimd_store_pd       _mm_storeu_pd
+#define lsimd_set1_pd        _mm_set1_pd
+#define lsimd_add_pd         _mm_add_pd
+#define lsimd_sub_pd         _mm_sub_pd
+#define lsimd_mul_pd         _mm_mul_pd
+#define lsimd_div_pd         _mm_div_pd
+#endif
+
+/* r[j] = r[j] op y[j] for every j, or r[j] op s if y is NULL, in longs.
+   0 if one of them overflows or divides by zero */
+static int lvec_int_step (long *r, const long *y, long s, int len, char op)
+{
+	int j = 0;
+
+	if (op == '*' || op == '/' || op == '%') {
+		for (; j < len; j++) {
+			long b = y ? y[j] : s;
+			if (op == '*') {
+				if (!lmul_ok (r[j], b, &r[j]))
+					return 0;
+			} else if (b == 0 || (b == -1 && r[j] == LONG_MIN)) {
+				return 0;
+			} else {
+				r[j] = op == '/' ? r[j] / b : r[j] % b;
+			}
+		}
+		return 1;
+	}
+
+	/* a + b overflowed if the sign of the sum is that of neither, a - b
+	   if the signs differ and the result's is not a's */
+	unsigned long over = 0;
+#if defined(LSIMD_LANES) && LONG_MAX == INT64_MAX
+	lsimd_si vs = lsimd_set1_si (s);
+	lsimd_si vover = lsimd_zero_si ();
+	for (; j + LSIMD_LANES <= len; j += LSIMD_LANES) {
+		lsimd_si a = lsimd_load_si (r + j);
+		lsimd_si b = y ? lsimd_load_si (y + j) : vs;
+		lsimd_si t;
+		if (op == '+') {
+			t = lsimd_add_si (a, b);
+			b = lsimd_xor_si (b, t);
+		} else {
+			t = lsimd_sub_si (a, b);
+			b = lsimd_xor_si (a, b);
+		}
+		vover = lsimd_or_si (vover, lsimd_and_si (lsimd_xor_si (a, t), b));
+		lsimd_store_si (r + j, t);
+	}
+	unsigned long o[LSIMD_LANES];
+	lsimd_store_si (o, vover);
+	for (int k = 0; k < LSIMD_LANES; k++)
+		over |= o[k];
+#endif
+	for (; j < len; j++) {
+		long a = r[j];
+		long b = y ? y[j] : s;
+		long t;
+		if (op == '+') {
+			t = (long) ((unsigned long) a + (unsigned long) b);
+			over |= (unsigned long) ((a ^ t) & (b ^ t));
+		} else {
+			t = (long) ((unsigned long) a - (unsigned long) b);
+			over |= (unsigned long) ((a ^ t) & (a ^ b));
+		}
+		r[j] = t;
+	}
+	return !(over >> (sizeof(long) * CHAR_BIT - 1));
+}
+
+/* The same in doubles, 0 on a zero divisor */
+static int lvec_dbl_step (double *r, const double *y, double s, int len,
+			  char op)
+{
+	int j = 0;
+
+	if (op == '/' || op == '%') {
+		for (int i = 0; i < (y ? len : 1); i++) {
+			if ((y ? y[i] : s) == 0.0)
+				return 0;
+		}
+	}
+	if (op == '%') {
+		for (; j < len; j++)
+			r[j] = fmod (r[j], y ? y[j] : s);
+		return 1;
+	}
+
+#ifdef LSIMD_LANES
+	lsimd_pd vs = lsimd_set1_pd (s);
+	for (; j + LSIMD_LANES <= len; j += LSIMD_LANES) {
+		lsimd_pd a = lsimd_load_pd (r + j);
+		lsimd_pd b = y ? lsimd_load_pd (y + j) : vs;
+		switch (op) {
+		case '+': a = lsimd_add_pd (a, b); break;
+		case '-': a = lsimd_sub_pd (a, b); break;
+		case '*': a = lsimd_mul_pd (a, b); break;
+		case '/': a = lsimd_div_pd (a, b); break;
+		}
+		lsimd_store_pd (r + j, a);
+	}
+#endif
+	for (; j < len; j++) {
+		double b = y ? y[j] : s;
+		switch (op) {
+		case '+': r[j] += b; break;
+		case '-': r[j] -= b; break;
+		case '*': r[j] *= b; break;
+		case '/': r[j] /= b; break;
+		}
+	}
+	return 1;
+}
+
+/* op over cell[0..n) folded straight into a new vector, NULL if not all
+   of the lists are vectors or the longs don't make it */
+static lval *lvec_packed (lval **cell, int n, char op)
+{
+	int len = -1;
+	int dbl = 0;
+	for (int i = 0; i < n; i++) {
+		lval *v = cell[i];
+		int t = lval_type (v);
+		if (t == LVAL_VEC) {
+			if (len >= 0 && v->count != len)
+				return NULL;
+			len = v->count;
+			dbl |= v->elem == LVAL_DBL;
+		} else if (t == LVAL_DBL) {
+			dbl = 1;
+		} else if (t != LVAL_NUM || lval_is_big (v)) {
+			return NULL;
+		}
+	}
+
+	lval *x = lval_vec (dbl ? LVAL_DBL : LVAL_NUM, len);
+	if (len == 0)
+		return x;
+
+	/* Long vectors in a double operation are converted here */
+	double *conv = NULL;
+	int ok = 1;
+	for (int i = 0; i < n && ok; i++) {
+		lval *v = cell[i];
+		const void *y = NULL;
+		long ys = 0;
+		double ds = 0.0;
+		if (lval_type (v) != LVAL_VEC) {
+			if (dbl)
+				ds = lval_to_double (v);
+			else
+				ys = lval_number (v);
+		} else if (dbl && v->elem != LVAL_DBL) {
+			if (conv == NULL)
+				conv = malloc (sizeof(double) * len);
+			for (int j = 0; j < len; j++)
+				conv[j] = (double) lvec_ints (v)[j];
+			y = conv;
+		} else {
+			y = lvec_ints (v);
+		}
+
+		/* The first argument is where the result starts from */
+		if (i == 0) {
+			if (y)
+				memcpy (lvec_ints (x), y, lvec_width (x) * len);
+			for (int j = 0; j < len && !y; j++) {
+				if (dbl)
+					lvec_dbls (x)[j] = ds;
+				else
+					lvec_ints (x)[j] = ys;
+			}
+			continue;
+		}
+		ok = dbl ? lvec_dbl_step (lvec_dbls (x), y, ds, len, op)
+			 : lvec_int_step (lvec_ints (x), y, ys, len, op);
+	}
+
+	/* A lone argument of - is negated */
+	if (ok && n == 1 && op == '-') {
+		long zero = 0;
+		if (dbl) {
+			for (int j = 0; j < len; j++)
+				lvec_dbls (x)[j] = -lvec_dbls (x)[j];
+		} else {
+			long *r = lvec_ints (x);
+			for (int j = 0; j < len && ok; j++)
+				ok = lsub_ok (zero, r[j], &r[j]);
+		}
+	}
+
+	free (conv);
+	if (!ok) {
+		lval_del (x);
+		return NULL;
+	}
+	return x;
+}
+
+/* op over cell[0..n) through the scalar kernel k, one element at a time */
+static lval *lvec_cells (lval **cell, int n, lkernel k)
+{
+	int len = -1;
+	for (int i = 0; i < n; i++) {
+		if (!(LTYPE(lval_type (cell[i])) & LTYPE_LIST))
+			continue;
+		if (len >= 0 && cell[i]->count != len)
+			return lval_err ("Lists of different lengths.");
+		len = cell[i]->count;
+	}
+
+	lval **argv = malloc (sizeof(lval*) * n);
+	/* Where each cons list has got to */
+	lcons **runs = malloc (sizeof(lcons*) * n);
+	int *ats = malloc (sizeof(int) * n);
+	for (int i = 0; i < n; i++) {
+		if (lval_type (cell[i]) == LVAL_CONS) {
+			runs[i] = cell[i]->cons;
+			ats[i] = cell[i]->front;
+		}
+	}
+	lval *x = lval_reserve (lval_qexpr (), len);
+	for (int j = 0; j < len; j++) {
+		int bad = 0;
+		for (int i = 0; i < n; i++) {
+			lval *v = cell[i];
+			if (lval_type (v) == LVAL_VEC)
+				argv[i] = lvec_get (v, j);
+			else if (lval_type (v) == LVAL_RRB)
+				argv[i] = lrrb_get (v->rrb, j);
+			else if (lval_type (v) == LVAL_CONS)
+				argv[i] = lcons_next (&runs[i], &ats[i]);
+			else if (lval_type (v) == LVAL_QEXPR)
+				argv[i] = v->cell[j];
+			else
+				argv[i] = v;
+			if (!(LTYPE(lval_type (argv[i]))
+			      & (LTYPE_NUMBER | LTYPE_LIST)))
+				bad = 1;
+		}
+
+		lval *r = bad ? lval_err ("Cannot operate on non-number!")
+			      : k (argv, n);
+		for (int i = 0; i < n; i++) {
+			if (lval_type (cell[i]) == LVAL_VEC)
+				lval_del (argv[i]);
+		}
+		if (lval_type (r) == LVAL_ERR) {
+			lval_del (x);
+			free (argv);
+			free (runs);
+			free (ats);
+			return r;
+		}
+		x = lval_add (x, r);
+	}
+	free (argv);
+	free (runs);
+	free (ats);
+	return lval_pack (x);
+}
+
+static lval *lvec_op (lval **cell, int n, char op)
+{
+	for (int i = 0; i < n; i++) {
+		if (LTYPE(lval_type (cell[i])) & LTYPE_LIST)
+			lwork += (unsigned long) cell[i]->count / LWORK_UNITS;
+	}
+
+	lval *x = lvec_packed (cell, n, op);
+	if (x)
+		return x;
+
+	switch (op) {
+	case '+': return lvec_cells (cell, n, lkernel_add);
+	case '-': return lvec_cells (cell, n, lkernel_sub);
+	case '*': return lvec_cells (cell, n, lkernel_mul);
+	case '/': return lvec_cells (cell, n, lkernel_div);
+	default:  return lvec_cells (cell, n, lkernel_mod);
+	}
+}
+
+/* Return the numbers as a vector, of doubles if any of them is one */
+lval *builtin_vec (lenv *e, lval *a)
+{
+	int dbl = (ltypes (a->cell, a->count) & LTYPE(LVAL_DBL)) != 0;
+	for (int i = 0; i < a->count && !dbl; i++) {
+		LASSERT (a, !lval_is_big (a->cell[i]),
+			 "Function 'vec' passed a number too big to pack.");
+	}
+
+	lval *x = lval_vec (dbl ? LVAL_DBL : LVAL_NUM, a->count);
+	for (int i = 0; i < a->count; i++) {
+		if (dbl)
+			lvec_dbls (x)[i] = lval_to_double (a->cell[i]);
+		else
+			lvec_ints (x)[i] = lval_number (a->cell[i]);
+	}
+	lval_del (a);
+	return x;
+}
+
+lval *builtin_op (lenv *e, lval *a, lkernel k)
+{
+	lval *x = k (a->cell, a->count);
+
+	/* Delete input expression and return result */
+	lval_del (a);
+	return x;
+}
+
+lval *builtin_add (lenv *e, lval *a) { return builtin_op (e, a, lkernel_add); }
+lval *builtin_sub (lenv *e, lval *a) { return builtin_op (e, a, lkernel_sub); }
+lval *builtin_mul (lenv *e, lval *a) { return builtin_op (e, a, lkernel_mul); }
+lval *builtin_div (lenv *e, lval *a) { return builtin_op (e, a, lkernel_div); }
+lval *builtin_mod (lenv *e, lval *a) { return builtin_op (e, a, lkernel_mod); }
+
+/* Every builtin, registered in the root environment by lenv_add_builtins */
+lbuiltin_def lbuiltins[] = {
+	{ "list",  builtin_list,  0, -1, LTYPE_ANY,         1, NULL },
+	{ "vec",   builtin_vec,   0, -1, LTYPE_NUMBER,      1, NULL },
+	{ "first", builtin_first, 1,  1, LTYPE_LIST,        1, NULL },
+	{ "rest",  builtin_rest,  1,  1, LTYPE_LIST,        1, NULL },
+	{ "eval",  builtin_eval,  1,  1, LTYPE_LIST,        0, NULL },
+	{ "conj",  builtin_conj,  1, -1, LTYPE_LIST,        1, NULL },
+	{ "cons",  builtin_cons,  2,  2, LTYPE_ANY,         1, NULL },
+	{ "+",     builtin_add,   1, -1, LTYPE_OPERAND,     1,
+	  "Cannot operate on non-number!" },
+	{ "-",     builtin_sub,   1, -1, LTYPE_OPERAND,     1,
+	  "Cannot operate on non-number!" },
+	{ "*",     builtin_mul,   1, -1, LTYPE_OPERAND,     1,
+	  "Cannot operate on non-number!" },
+	{ "/",     builtin_div,   1, -1, LTYPE_OPERAND,     1,
+	  "Cannot operate on non-number!" },
+	{ "%",     builtin_mod,   1, -1, LTYPE_OPERAND,     1,
+	  "Cannot operate on non-number!" },
+};
+
+void lenv_add_builtins (lenv *e)
+{
+	int n = sizeof(lbuiltins) / sizeof(lbuiltins[0]);
+	for (int i = 0; i < n; i++) {
+		lval *k = lval_sym (lbuiltins[i].name);
+		lval *v = lval_fun (&lbuiltins[i]);
+		lenv_put (e, k, v);
+		lval_del (k);
+		lval_del (v);
+	}
+}
+
+/* Check a against the arity and types of f, then call it */
+lval *lval_call (lenv *e, lval *f, lval *a)
+{
+	lbuiltin_def *d = f->fun;
+	char msg[128];
+
+	if (a->count < d->min_args || (d->max_args >= 0 && a->count > d->max_args)) {
+		snprintf (msg, sizeof(msg), "Function '%s' passed too %s arguments.",
+			  d->name, a->count < d->min_args ? "few" : "many");
+		lval_del (a);
+		return lval_err (msg);
+	}
+
+	if (d->arg_types != LTYPE_ANY) {
+		for (int i = 0; i < a->count; i++) {
+			if (LTYPE(lval_type (a->cell[i])) & d->arg_types)
+				continue;
+			snprintf (msg, sizeof(msg), "Function '%s' passed incorrect type.",
+				  d->name);
+			lval_del (a);
+			return lval_err (d->type_err ? d->type_err : msg);
+		}
+	}
+
+	return d->call (e, a);
+}
+
+/* Memo cache
+ *
+ * With --memo the tree walker remembers the value of every expression it
+ * is asked for (each line, and each list handed to eval) that calls only
+ * pure builtins and took enough work to evaluate, keyed by a hash of its
+ * first few nodes and the environment version it was evaluated in, and
+ * confirmed by comparing the whole expression. A hit costs about that
+ * comparison, so cheaper expressions would take longer to look up than
+ * to evaluate again. Expressions too small to ever take that much work
+ * are not even hashed. Cheap and impure ones above that leave an entry
+ * with no value instead: the same expression is then evaluated directly,
+ * without the copy and checks a miss takes. Work is counted in lwork steps, not
+ * time, so what is remembered is the same from run to run. Entries form
+ * an LRU list and the least recently used go once their estimated size
+ * passes the cap.
+ */
+typedef struct lmemo_entry {
+	unsigned long hash;
+	lval *key;                      /* Expression, as read */
+	lval *val;                      /* NULL if not worth remembering */
+	lenv *env;
+	int version;
+	size_t size;
+	struct lmemo_entry *chain;      /* Next in the bucket */
+	struct lmemo_entry *newer, *older;
+} lmemo_entry;
+
+/* Default size cap, --memo=KB sets another */
+#define LMEMO_CAP (16 << 20)
+
+/* Deeper expressions are not remembered, their purity check,
+   comparison and size would take that much C stack */
+#define LMEMO_DEPTH 1024
+
+/* Nodes hashed into a key */
+#define LMEMO_KEY 16
+
+/* Evaluations taking fewer lwork steps than this, or than one per
+   LMEMO_BYTES of the expression, are not remembered */
+#define LMEMO_MIN_WORK 500
+#define LMEMO_BYTES 64
+
+/* Expressions weighing less than this in lmemo_weight are evaluated
+   without a lookup: n units of numbers and items take at most about
+   n + n * n / (2 * LWORK_UNITS) steps, below LMEMO_MIN_WORK */
+#define LMEMO_LIGHT 64
+
+/* Expressions of at most this many nodes can leave an entry with no
+   value. The node count, up to one past this, is hashed too, so larger
+   expressions are never compared with those */
+#define LMEMO_SMALL 256
+
+/* Entries kept per hash and environment version, older ones make way so
+   expressions hashing alike cannot make lookups slow */
+#define LMEMO_SAME 8
+
+struct {
+	int on;
+	size_t cap, size;
+	lmemo_entry **buckets;
+	int nbuckets, count;
+	lmemo_entry *newest, *oldest;
+	unsigned long hits, misses, skips, evictions;
+} lmemo;
+
+/* Hash of the first LMEMO_KEY nodes of v, in order, and the length of
+   every list among them. The rest is left to lval_equal, so a hit costs
+   one walk over the expression instead of two */
+static unsigned long lmemo_hash (lval *v, int *budget)
+{
+	/* Numbers that fit are immediates, and never equal to a box */
+	if (lval_is_immediate (v))
+		return ((uintptr_t) v ^ 14695981039346656037UL) * 1099511628211UL;
+
+	unsigned long h = 14695981039346656037UL;
+	h = (h ^ v->type) * 1099511628211UL;
+
+	switch (v->type) {
+	case LVAL_NUM:
+		if (lval_is_big (v)) {
+			for (int i = 0; i < v->big->n; i++)
+				h = (h ^ v->big->d[i]) * 1099511628211UL;
+			return (h ^ v->big->neg) * 1099511628211UL;
+		}
+		return (h ^ (unsigned long) v->num) * 1099511628211UL;
+	case LVAL_DBL: {
+		uint64_t b;
+		memcpy (&b, &v->dbl, sizeof(b));
+		return (h ^ b) * 1099511628211UL;
+	}
+	case LVAL_SYM:
+		return (h ^ (uintptr_t) v->sym) * 1099511628211UL;
+	case LVAL_ERR:
+		for (char *c = v->err; *c; c++)
+			h = (h ^ (unsigned char) *c) * 1099511628211UL;
+		return h;
+	case LVAL_FUN:
+		return (h ^ (uintptr_t) v->fun) * 1099511628211UL;
+	case LVAL_VEC:
+		h = (h ^ v->elem) * 1099511628211UL;
+		for (int i = 0; i < v->count && *budget > 0; i++, (*budget)--) {
+			uint64_t b = 0;
+			memcpy (&b, (char*) lvec_ints (v) + i * lvec_width (v),
+				lvec_width (v));
+			h = (h ^ b) * 1099511628211UL;
+		}
+		return (h ^ v->count) * 1099511628211UL;
+	case LVAL_RRB:
+	case LVAL_CONS:
+		return (h ^ v->count) * 1099511628211UL;
+	default:
+		for (int i = 0; i < v->count && *budget > 0; i++) {
+			(*budget)--;
+			h = (h ^ lmemo_hash (v->cell[i], budget)) * 1099511628211UL;
+		}
+		return (h ^ v->count) * 1099511628211UL;
+	}
+}
+
+/* Nodes in v, or limit + 1 if more. Lists in trees count as more */
+static int lmemo_nodes (lval *v, int limit)
+{
+	if (lval_is_immediate (v))
+		return 1;
+	if (v->type == LVAL_RRB || v->type == LVAL_CONS)
+		return limit + 1;
+	if (v->type != LVAL_SEXPR && v->type != LVAL_QEXPR)
+		return 1;
+
+	int n = 1;
+	for (int i = 0; i < v->count && n <= limit; i++)
+		n += lmemo_nodes (v->cell[i], limit - n);
+	return n <= limit ? n : limit + 1;
+}
+
+/* Nodes in v, with numbers weighing a unit per 32 bit digit and lists in
+   vectors or trees one per item, or limit if that much or more */
+static int lmemo_weight (lval *v, int limit)
+{
+	if (lval_is_immediate (v))
+		return 2;
+	switch (v->type) {
+	case LVAL_NUM:
+		return lval_is_big (v) ? v->big->n : 2;
+	case LVAL_VEC:
+	case LVAL_RRB:
+	case LVAL_CONS:
+		return v->count < limit ? v->count + 1 : limit;
+	case LVAL_SEXPR:
+	case LVAL_QEXPR:
+		break;
+	default:
+		return 1;
+	}
+
+	int n = 1;
+	for (int i = 0; i < v->count && n < limit; i++) {
+		lval *x = v->cell[i];
+		n += lval_is_immediate (x) ? 2 : lmemo_weight (x, limit - n);
+	}
+	return n < limit ? n : limit;
+}
+
+/* Whether evaluating v calls only pure builtins, and v nests no deeper
+   than LMEMO_DEPTH. Q-Expressions are data, their symbols are not
+   looked up */
+static int lmemo_pure (lenv *e, lval *v, int quoted, int depth)
+{
+	if (depth > LMEMO_DEPTH)
+		return 0;
+
+	switch (lval_type (v)) {
+	case LVAL_SYM:
+		if (!quoted) {
+			int i = lenv_slot (e, v->sym);
+			lval *f = e->syms[i] ? e->vals[i] : NULL;
+			if (f && lval_type (f) == LVAL_FUN && !f->fun->pure)
+				return 0;
+		}
+		return 1;
+	case LVAL_RRB:
+	case LVAL_CONS: {
+		lval **items = malloc (sizeof(lval*) * v->count);
+		if (v->type == LVAL_CONS)
+			lcons_items (v, items);
+		else
+			lrrb_items (v->rrb, items);
+		int i = 0;
+		while (i < v->count && lmemo_pure (e, items[i], 1, depth + 1))
+			i++;
+		free (items);
+		return i == v->count;
+	}
+	case LVAL_SEXPR:
+	case LVAL_QEXPR:
+		for (int i = 0; i < v->count; i++) {
+			if (!lmemo_pure (e, v->cell[i],
+					 quoted || v->type == LVAL_QEXPR, depth + 1))
+				return 0;
+		}
+		return 1;
+	default:
+		return 1;
+	}
+}
+
+/* Same structure and contents */
+static int lval_equal (lval *x, lval *y)
+{
+	if (x == y)
+		return 1;
+	if (lval_type (x) != lval_type (y))
+		return 0;
+
+	switch (lval_type (x)) {
+	case LVAL_NUM:
+		if (lval_is_big (x) || lval_is_big (y))
+			return lval_is_big (x) && lval_is_big (y)
+			       && x->big->neg == y->big->neg
+			       && lmag_cmp (x->big->d, x->big->n,
+					    y->big->d, y->big->n) == 0;
+		return lval_number (x) == lval_number (y);
+	case LVAL_DBL: {
+		/* The same bits, so -0.0 is not 0.0 and a NaN is itself */
+		double a = lval_double (x), b = lval_double (y);
+		return memcmp (&a, &b, sizeof(a)) == 0;
+	}
+	case LVAL_SYM:
+		return x->sym == y->sym;
+	case LVAL_ERR:
+		return strcmp (x->err, y->err) == 0;
+	case LVAL_FUN:
+		return x->fun == y->fun;
+	case LVAL_VEC:
+		return x->elem == y->elem && x->count == y->count
+		       && memcmp (lvec_ints (x), lvec_ints (y),
+				  x->count * lvec_width (x)) == 0;
+	case LVAL_RRB:
+	case LVAL_CONS: {
+		if (x->count != y->count)
+			return 0;
+		lval **a = malloc (sizeof(lval*) * x->count * 2);
+		lval **b = a + x->count;
+		if (x->type == LVAL_CONS) {
+			lcons_items (x, a);
+			lcons_items (y, b);
+		} else {
+			lrrb_items (x->rrb, a);
+			lrrb_items (y->rrb, b);
+		}
+		int i = 0;
+		while (i < x->count && lval_equal (a[i], b[i]))
+			i++;
+		free (a);
+		return i == x->count;
+	}
+	default:
+		if (x->count != y->count)
+			return 0;
+		for (int i = 0; i < x->count; i++) {
+			if (!lval_equal (x->cell[i], y->cell[i]))
+				return 0;
+		}
+		return 1;
+	}
+}
+
+static size_t lval_size (lval *v);
+
+static size_t lrrb_bytes (lrrb *n)
+{
+	size_t b = sizeof(lrrb) + (n->height ? sizeof(int) * LRRB_M : 0);
+	for (int i = 0; i < n->count; i++)
+		b += n->height ? lrrb_bytes (n->slot[i]) : lval_size (n->slot[i]);
+	return b;
+}
+
+/* Bytes held by v, counting shared nodes as often as they are reached */
+static size_t lval_size (lval *v)
+{
+	if (lval_is_immediate (v))
+		return 0;
+
+	size_t n = sizeof(lval);
+	if (v->type == LVAL_NUM && v->big)
+		n += sizeof(lbig) + sizeof(uint32_t) * v->big->n;
+	if (v->type == LVAL_ERR)
+		n += strlen (v->err) + 1;
+	if (v->type == LVAL_VEC)
+		n += sizeof(double) * v->cap;
+	if (v->type == LVAL_RRB)
+		n += lrrb_bytes (v->rrb);
+	if (v->type == LVAL_CONS) {
+		/* Whole runs, as far as this list reaches into them */
+		lcons *r = v->cons;
+		lcons *seen = NULL;
+		int at = v->front;
+		for (int i = 0; i < v->count; i++) {
+			if (r != seen)
+				n += sizeof(lcons);
+			seen = r;
+			n += lval_size (lcons_next (&r, &at));
+		}
+	}
+	if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {
+		n += sizeof(lval*) * v->cap;
+		for (int i = 0; i < v->count; i++)
+			n += lval_size (v->cell[i]);
+	}
+	return n;
+}
+
+static void lmemo_unlink (lmemo_entry *m)
+{
+	if (m->newer)
+		m->newer->older = m->older;
+	else
+		lmemo.newest = m->older;
+	if (m->older)
+		m->older->newer = m->newer;
+	else
+		lmemo.oldest = m->newer;
+}
+
+static void lmemo_push (lmemo_entry *m)
+{
+	m->newer = NULL;
+	m->older = lmemo.newest;
+	if (lmemo.newest)
+		lmemo.newest->newer = m;
+	else
+		lmemo.oldest = m;
+	lmemo.newest = m;
+}
+
+static void lmemo_drop (lmemo_entry *m)
+{
+	lmemo_entry **p = &lmemo.buckets[m->hash & (lmemo.nbuckets - 1)];
+	while (*p != m)
+		p = &(*p)->chain;
+	*p = m->chain;
+
+	lmemo_unlink (m);
+	lmemo.size -= m->size;
+	lmemo.count--;
+	lval_del (m->key);
+	if (m->val)
+		lval_del (m->val);
+	free (m);
+}
+
+/* Drop the least recently used entry */
+static void lmemo_evict (void)
+{
+	lmemo.evictions++;
+	lmemo_drop (lmemo.oldest);
+}
+
+/* Value remembered for v in e, or NULL. *hash is set for lmemo_put,
+   0 if v is not to be remembered */
+lval *lmemo_get (lenv *e, lval *v, unsigned long *hash)
+{
+	if (lmemo_weight (v, LMEMO_LIGHT) < LMEMO_LIGHT) {
+		lmemo.skips++;
+		*hash = 0;
+		return NULL;
+	}
+
+	int budget = LMEMO_KEY;
+	*hash = (lmemo_hash (v, &budget) ^ lmemo_nodes (v, LMEMO_SMALL))
+		* 1099511628211UL | 1;
+
+	/* Keys were pure in the environment version they were put in */
+	if (lmemo.nbuckets) {
+		lmemo_entry *m = lmemo.buckets[*hash & (lmemo.nbuckets - 1)];
+		for (; m; m = m->chain) {
+			if (m->hash != *hash || m->env != e || m->version != e->version
+			    || !lval_equal (m->key, v))
+				continue;
+			lmemo_unlink (m);
+			lmemo_push (m);
+			if (!m->val) {
+				lmemo.skips++;
+				*hash = 0;
+				return NULL;
+			}
+			lmemo.hits++;
+			return lval_copy (m->val);
+		}
+	}
+	lmemo.misses++;
+	return NULL;
+}
+
+/* Whether key, work lwork steps to evaluate, is pure and costly enough
+   for a hit to pay */
+static int lmemo_worth (lenv *e, lval *key, unsigned long work)
+{
+	return work >= LMEMO_MIN_WORK && lmemo_pure (e, key, 0, 0)
+	       && work >= lval_size (key) / LMEMO_BYTES;
+}
+
+/* Remember val for key, evaluated from lwork step from on, taking over
+   both. If that is not worth it, or there is no value, only the key stays,
+   and nothing if it is not small */
+void lmemo_put (lenv *e, unsigned long hash, lval *key, lval *val,
+		unsigned long from)
+{
+	if (val && !lmemo_worth (e, key, lwork - from)) {
+		lval_del (val);
+		val = NULL;
+	}
+	if (!val && lmemo_nodes (key, LMEMO_SMALL) > LMEMO_SMALL) {
+		lval_del (key);
+		return;
+	}
+	size_t size = sizeof(lmemo_entry) + lval_size (key)
+		      + (val ? lval_size (val) : 0);
+
+	/* Nested evaluations of the same expression finish one by one, it
+	   is remembered only once */
+	lmemo_entry *oldest = NULL;
+	int same = 0;
+	for (lmemo_entry *m = lmemo.nbuckets
+		     ? lmemo.buckets[hash & (lmemo.nbuckets - 1)] : NULL;
+	     m; m = m->chain) {
+		if (m->hash != hash || m->env != e || m->version != e->version)
+			continue;
+		if (lval_equal (m->key, key)) {
+			lval_del (key);
+			if (val)
+				lval_del (val);
+			return;
+		}
+		oldest = m;
+		same++;
+	}
+	if (same >= LMEMO_SAME)
+		lmemo_drop (oldest);
+
+	if (size > lmemo.cap) {
+		lval_del (key);
+		if (val)
+			lval_del (val);
+		return;
+	}
+	while (lmemo.size + size > lmemo.cap)
+		lmemo_evict ();
+
+	/* Keep the buckets at most as many as the entries */
+	if (lmemo.count >= lmemo.nbuckets) {
+		int n = lmemo.nbuckets ? lmemo.nbuckets * 2 : 64;
+		lmemo_entry **b = calloc (n, sizeof(lmemo_entry*));
+		for (int i = 0; i < lmemo.nbuckets; i++) {
+			while (lmemo.buckets[i]) {
+				lmemo_entry *m = lmemo.buckets[i];
+				lmemo.buckets[i] = m->chain;
+				m->chain = b[m->hash & (n - 1)];
+				b[m->hash & (n - 1)] = m;
+			}
+		}
+		free (lmemo.buckets);
+		lmemo.buckets = b;
+		lmemo.nbuckets = n;
+	}
+
+	lmemo_entry *m = malloc (sizeof(lmemo_entry));
+	m->hash = hash;
+	m->key = key;
+	m->val = val;
+	m->env = e;
+	m->version = e->version;
+	m->size = size;
+	m->chain = lmemo.buckets[hash & (lmemo.nbuckets - 1)];
+	lmemo.buckets[hash & (lmemo.nbuckets - 1)] = m;
+	lmemo_push (m);
+	lmemo.size += size;
+	lmemo.count++;
+}
+
+void lmemo_stats_print (void)
+{
+	fflush (stdout);
+	fprintf (stderr, "; memo %lu hits %lu misses %lu skipped %lu evicted "
+		 "%d entries %lu/%lu bytes\n", lmemo.hits, lmemo.misses,
+		 lmemo.skips, lmemo.evictions, lmemo.count,
+		 (unsigned long) lmemo.size, (unsigned long) lmemo.cap);
+}
+
+/* Tree walking evaluator
+ *
+ * S-Expressions being evaluated are kept on an explicit stack of frames
+ * rather than on the C stack, each frame holding the expression and the
+ * index of the item to evaluate next. Evaluated items replace theirs in
+ * place; the first error drops the rest of the frame, there is nothing
+ * else to undo as evaluation has no side effects. A call to eval takes
+ * over the frame of its caller, so eval chains run in constant space.
+ */
+typedef struct {
+	lval *v;
+	int i;
+	lval *memo;           /* Expression to remember the value of */
+	unsigned long hash;
+	unsigned long work;   /* lwork when its evaluation began */
+} lframe;
+
+struct {
+	lframe *frames;
+	int count, cap;
+} leval_stack;
+
+lval *lval_eval(lenv *e, lval *v)
+{
+	int base = leval_stack.count;
+	int root = 1;
+	lframe *f;
+	lval *x;
+	lval *memo = NULL;
+	unsigned long hash = 0;
+	unsigned long work = 0;
+
+eval:
+	lwork++;
+
+	/* Symbols are looked up in the environment */
+	if (lval_type (v) == LVAL_SYM) {
+		x = lenv_get (e, v);
+		lval_del (v);
+		goto ret;
+	}
+
+	/* All other lval types but S-Expressions return the same */
+	if (lval_type (v) != LVAL_SEXPR) {
+		x = v;
+		goto ret;
+	}
+
+	/* Expressions asked for as a whole may be remembered */
+	if (root && lmemo.on && !lalloc.arena_on && v->count > 0) {
+		x = lmemo_get (e, v, &hash);
+		if (x) {
+			lval_del (v);
+			goto ret;
+		}
+		if (hash) {
+			memo = lval_copy (v);
+			work = lwork;
+		}
+	}
+	root = 0;
+
+	/* Evaluation rewrites the cells in place */
+	v = lval_unshare (v);
+	if (v->count == 0) {
+		x = v;
+		goto ret;
+	}
+
+	if (leval_stack.count == leval_stack.cap) {
+		leval_stack.cap = leval_stack.cap ? leval_stack.cap * 2 : 64;
+		leval_stack.frames = realloc (leval_stack.frames,
+					      sizeof(lframe) * leval_stack.cap);
+	}
+	f = &leval_stack.frames[leval_stack.count++];
+	f->v = v;
+	f->i = 0;
+	f->memo = memo;
+	f->hash = hash;
+	f->work = work;
+	memo = NULL;
+
+next:
+	/* Evaluate the next item of the frame on top */
+	f = &leval_stack.frames[leval_stack.count - 1];
+	if (f->i < f->v->count) {
+		v = f->v->cell[f->i];
+		goto eval;
+	}
+
+	/* Every item is evaluated, apply the frame */
+	v = f->v;
+	memo = f->memo;
+	hash = f->hash;
+	work = f->work;
+	leval_stack.count--;
+
+	/* Single Expression */
+	if (v->count == 1) {
+		x = lval_take (v, 0);
+		goto ret;
+	}
+
+	/* Ensure first Element is a function */
+	lval *fn = lval_pop (v, 0);
+	if (lval_type (fn) != LVAL_FUN) {
+		lval_del (fn);
+		lval_del (v);
+		x = lval_err ("S-Expression does not start with a function.");
+		goto ret;
+	}
+
+	/* Tail call of eval, evaluate its list in place of this frame. eval
+	   is impure, the frame has no value to remember */
+	if (fn->fun->call == builtin_eval && v->count == 1
+	    && (LTYPE(lval_type (v->cell[0])) & LTYPE_LIST)) {
+		if (memo) {
+			lmemo_put (e, hash, memo, NULL, work);
+			memo = NULL;
+		}
+		lval_del (fn);
+		v = lval_unshare (lval_unpack (lval_take (v, 0)));
+		v->type = LVAL_SEXPR;
+		root = 1;
+		goto eval;
+	}
+
+	/* Call builtin with operator */
+	x = lval_call (e, fn, v);
+	lval_del (fn);
+
+ret:
+	/* x is the value of the frame just left */
+	if (memo) {
+		lmemo_put (e, hash, memo, lval_copy (x), work);
+		memo = NULL;
+	}
+
+	if (leval_stack.count == base)
+		return x;
+
+	/* Hand x to the frame waiting for it */
+	f = &leval_stack.frames[leval_stack.count - 1];
+	f->v->cell[f->i++] = x;
+	if (lval_type (x) == LVAL_ERR) {
+		leval_stack.count--;
+		memo = f->memo;
+		hash = f->hash;
+		work = f->work;
+		x = lval_take (f->v, f->i - 1);
+		goto ret;
+	}
+	goto next;
+}
+
+/* Constant folding
+ *
+ * lval_fold rewrites, innermost first, every S-Expression calling a pure
+ * builtin on literals (numbers and Q-Expressions) into its value. The
+ * insides of Q-Expressions are data and stay as they are. A call that
+ * raises an error is left in the tree, so the error comes out of the
+ * evaluation at the same point and ahead of the same others.
+ */
+static int lval_is_literal (lval *v)
+{
+	int t = lval_type (v);
+	return t == LVAL_NUM || t == LVAL_DBL || t == LVAL_QEXPR
+	       || t == LVAL_VEC || t == LVAL_RRB || t == LVAL_CONS;
+}
+
+/* v once its items are folded: its value if it calls a pure builtin on
+   literals and that does not fail, else v itself */
+static lval *lval_fold_call (lenv *e, lval *v)
+{
+	/* A single literal is its own value */
+	if (v->count == 1 && lval_is_literal (v->cell[0]))
+		return lval_take (v, 0);
+
+	if (v->count < 2 || lval_type (v->cell[0]) != LVAL_SYM)
+		return v;
+	for (int i = 1; i < v->count; i++)
+		if (!lval_is_literal (v->cell[i]))
+			return v;
+
+	lval *f = lenv_get (e, v->cell[0]);
+	int pure = lval_type (f) == LVAL_FUN && f->fun->pure;
+	lval_del (f);
+	if (!pure)
+		return v;
+
+	lval *x = lval_eval (e, lval_copy (v));
+	if (lval_type (x) == LVAL_ERR) {
+		lval_del (x);
+		return v;
+	}
+	lval_del (v);
+	return x;
+}
+
+/* Lists being folded, each with the item it is at, as in lval_eval */
+struct {
+	lframe *frames;
+	int count, cap;
+} lfold_stack;
+
+lval *lval_fold (lenv *e, lval *v)
+{
+	int base = lfold_stack.count;
+	lframe *f;
+	lval *x;
+
+fold:
+	if (lval_type (v) != LVAL_SEXPR) {
+		x = v;
+		goto ret;
+	}
+	if (lfold_stack.count == lfold_stack.cap) {
+		lfold_stack.cap = lfold_stack.cap ? lfold_stack.cap * 2 : 64;
+		lfold_stack.frames = realloc (lfold_stack.frames,
+					      sizeof(lframe) * lfold_stack.cap);
+	}
+	f = &lfold_stack.frames[lfold_stack.count++];
+	f->v = lval_unshare (v);
+	f->i = 0;
+
+next:
+	/* Fold the items of the frame on top, innermost first */
+	f = &lfold_stack.frames[lfold_stack.count - 1];
+	if (f->i < f->v->count) {
+		v = f->v->cell[f->i];
+		goto fold;
+	}
+	lfold_stack.count--;
+	x = lval_fold_call (e, f->v);
+
+ret:
+	if (lfold_stack.count == base)
+		return x;
+	f = &lfold_stack.frames[lfold_stack.count - 1];
+	f->v->cell[f->i++] = x;
+	goto next;
+}
+
+/* Number literal s, a long, a bignum or a double */
+lval *lval_read_number(const char *s)
+{
+	errno = 0;
+	if (strpbrk(s, ".eE")) {
+		double x = strtod(s, NULL);
+		/* Too small just rounds to zero */
+		return errno == ERANGE && isinf(x) ? lval_err("Invalid number")
+						   : lval_dbl(x);
+	}
+	long x = strtol(s, NULL, 10);
+	return errno != ERANGE ? lval_num(x) : lval_from_big(lbig_read(s));
+}
+
+/* The token from p to end as an lval, end - p is at least one */
+static lval *lread_token (const char *p, const char *end, int number)
+{
+	char buf[64];
+	size_t n = end - p;
+	char *s = n < sizeof(buf) ? buf : malloc (n + 1);
+	memcpy (s, p, n);
+	s[n] = '\0';
+	lval *x = number ? lval_read_number (s) : lval_sym (s);
+	if (s != buf)
+		free (s);
+	return x;
+}
+
+/* Leaf contents are slices of the input line, see mpc_parse_slices */
+static lval *lval_read_token(mpc_ast_t *t, int number)
+{
+	const char *p = mpc_ast_contents_ptr(t);
+	return lread_token(p, p + mpc_ast_contents_len(t), number);
+}
+
+lval *lval_read_num(mpc_ast_t *t)
+{
+	return lval_read_token(t, 1);
+}
+
+/* Tag ids of the lezchty grammar, interned when main builds it */
+static struct {
+	int number;
+	int symbol;
+	int qexpr;
+	int regex;
+} ltags;
+
+void lval_read_tags(void)
+{
+	ltags.number = mpc_tag_id("number");
+	ltags.symbol = mpc_tag_id("symbol");
+	ltags.qexpr = mpc_tag_id("qexpr");
+	ltags.regex = mpc_tag_id("regex");
+}
+
+/* A list being read from an mpc AST, and the next child of its node */
+typedef struct {
+  mpc_ast_t *t;
+  int i;
+  lval *list;
+} lread_node;
+
+/* Whether the child c of a list node is punctuation, not an expression */
+static int lval_read_skip(mpc_ast_t *c)
+{
+  if (mpc_ast_contents_len(c) == 1 && strchr("(){}", *mpc_ast_contents_ptr(c)))
+    return 1;
+  return mpc_ast_top_tag(c) == ltags.regex;
+}
+
+/* The lval for the AST t. Lists wait on a stack of their own while
+   their children are read, so nesting takes no C stack */
+lval *lval_read(mpc_ast_t *t)
+{
+  lread_node *open = NULL;
+  int depth = 0, cap = 0;
+  lval *x;
+
+  for (;;) {
+    if (mpc_ast_has_tag(t, ltags.number)) {
+      x = lval_read_num(t);
+    } else if (mpc_ast_has_tag(t, ltags.symbol)) {
+      x = lval_read_token(t, 0);
+    } else {
+      if (depth == cap) {
+        cap = cap ? cap * 2 : 16;
+        open = realloc(open, sizeof(lread_node) * cap);
+      }
+      /* The root (>) and sexprs both create an empty S-Expression. The
+         children include the brackets, so their count is an upper bound */
+      open[depth].t = t;
+      open[depth].i = 0;
+      open[depth].list = mpc_ast_has_tag(t, ltags.qexpr) ? lval_qexpr() : lval_sexpr();
+      lval_reserve(open[depth].list, t->children_num);
+      depth++;
+      x = NULL;
+    }
+
+    /* Hand x to the list waiting for it, finishing those that are done,
+       until one has a child left to read */
+    for (;;) {
+      if (depth == 0) {
+        free(open);
+        return x;
+      }
+      lread_node *f = &open[depth - 1];
+      if (x)
+        f->list = lval_add(f->list, x);
+      while (f->i < f->t->children_num && lval_read_skip(f->t->children[f->i]))
+        f->i++;
+      if (f->i < f->t->children_num) {
+        t = f->t->children[f->i++];
+        break;
+      }
+      /* Lists of plain numbers are read straight into vectors, long ones
+         into trees */
+      x = lval_pack(f->list);
+      depth--;
+    }
+  }
+}
+
+/* Direct reader
+ *
+ * lval_read_input reads a whole input buffer in one pass, building lvals
+ * as it goes instead of an mpc AST first. It accepts exactly what the
+ * lezchty grammar in main does: tokens are the first of number or symbol
+ * to match, so "12ab" is the number 12 followed by the symbol ab, and
+ * whitespace between tokens is optional. The mpc parser stays behind
+ * --reader=mpc to check it against.
+ */
+typedef struct {
+	const char *filename;
+	const char *input;
+	const char *p;        /* Next byte to read */
+	char *err;            /* Message of the error that stopped it */
+} lreader;
+
+static int lread_is_space (int c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f'
+	       || c == '\v';
+}
+
+static int lread_is_digit (int c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static int lread_is_symbol (int c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+	       || lread_is_digit (c) || (c && strchr ("_+-*/\\=<>!&%", c));
+}
+
+static void lread_space (lreader *r)
+{
+	while (lread_is_space (*r->p))
+		r->p++;
+}
+
+/* End of the number /-?[0-9]+(\.[0-9]+)?([eE][-+]?[0-9]+)?/ at p, or p
+   if there is none. Like mpc, a '.' after the integer digits is taken
+   even when no digits follow it, so "2." ends just after the '.' */
+static const char *lread_number_end (const char *p)
+{
+	const char *q = p + (*p == '-');
+	if (!lread_is_digit (*q))
+		return p;
+	while (lread_is_digit (*q))
+		q++;
+	if (*q == '.') {
+		if (!lread_is_digit (*++q))
+			return q;
+		while (lread_is_digit (*q))
+			q++;
+	}
+	if (*q == 'e' || *q == 'E') {
+		const char *e = q + 1;
+		e += *e == '-' || *e == '+';
+		if (lread_is_digit (*e)) {
+			q = e;
+			while (lread_is_digit (*q))
+				q++;
+		}
+	}
+	return q;
+}
+
+/* Report that expected was not found where r stopped. The place is the
+   one mpc reports, the expected part is shorter than mpc's list */
+static lval *lread_error (lreader *r, const char *expected)
+{
+	int row = 1, col = 1;
+	for (const char *c = r->input; c < r->p; c++) {
+		if (*c == '\n') {
+			row++;
+			col = 1;
+		} else {
+			col++;
+		}
+	}
+
+	char at[4] = { '\'', *r->p, '\'', '\0' };
+	const char *found = at;
+	switch (*r->p) {
+	case '\0': found = "end of input"; break;
+	case '\n': found = "newline"; break;
+	case '\t': found = "tab"; break;
+	case ' ': found = "space"; break;
+	}
+
+	size_t n = strlen (r->filename) + strlen (expected) + 64;
+	r->err = malloc (n);
+	snprintf (r->err, n, "%s:%d:%d: error: expected %s at %s\n",
+		  r->filename, row, col, expected, found);
+	return NULL;
+}
+
+/* The number or symbol at r->p, NULL if there is none */
+static lval *lread_atom (lreader *r, const char *expected)
+{
+	const char *start = r->p;
+	r->p = lread_number_end (start);
+	if (r->p > start && r->p[-1] == '.')
+		return lread_error (r, "one or more of one of '0123456789'");
+	if (r->p > start)
+		return lread_token (start, r->p, 1);
+
+	while (lread_is_symbol (*r->p))
+		r->p++;
+	if (r->p > start)
+		return lread_token (start, r->p, 0);
+
+	return lread_error (r, expected);
+}
+
+/* A list being read, and the byte that closes it */
+typedef struct {
+	lval *list;
+	char close;
+} lread_open;
+
+/* Every expression in input as one S-Expression, or NULL with *err set
+   to a message for the caller to print and free. The lists still open
+   wait on a stack of their own, so nesting takes no C stack */
+lval *lval_read_input (const char *filename, const char *input, char **err)
+{
+	lreader r = { filename, input, input, NULL };
+	lread_open *open = NULL;
+	int depth = 0, cap = 0;
+	lval *x = lval_sexpr ();
+	char close = '\0';
+
+	lread_space (&r);
+	for (;;) {
+		char c = *r.p;
+		if (c == close) {
+			if (depth == 0)
+				break;
+			r.p++;
+			/* Lists of plain numbers are read straight into vectors,
+			   long ones into trees */
+			lval *y = lval_pack (x);
+			depth--;
+			x = lval_add (open[depth].list, y);
+			close = open[depth].close;
+		} else if (c == '(' || c == '{') {
+			if (depth == cap) {
+				cap = cap ? cap * 2 : 16;
+				open = realloc (open, sizeof(lread_open) * cap);
+			}
+			open[depth].list = x;
+			open[depth].close = close;
+			depth++;
+			x = c == '(' ? lval_sexpr () : lval_qexpr ();
+			close = c == '(' ? ')' : '}';
+			r.p++;
+		} else {
+			lval *y = lread_atom (&r, close == ')' ? "expression or ')'"
+					      : close == '}' ? "expression or '}'"
+					      : "expression or end of input");
+			if (y == NULL) {
+				lval_del (x);
+				while (depth > 0)
+					lval_del (open[--depth].list);
+				free (open);
+				*err = r.err;
+				return NULL;
+			}
+			x = lval_add (x, y);
+		}
+		lread_space (&r);
+	}
+	free (open);
+	return x;
+}
+
+int main(int argc, char** argv)
+{
+  /* Command line options */
+  int use_arena = 0;
+  int show_stats = 0;
+  int dump = 0;
+  int use_mpc = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--arena") == 0)
+      use_arena = 1;
+    else if (strcmp(argv[i], "--stats") == 0)
+      show_stats = 1;
+    else if (strcmp(argv[i], "--fold") == 0)
+      lfold = 1;
+    else if (strcmp(argv[i], "--dump") == 0)
+      dump = 1;
+    else if (strcmp(argv[i], "--reader=mpc") == 0)
+      use_mpc = 1;
+    else if (strcmp(argv[i], "--reader=direct") == 0)
+      use_mpc = 0;
+    else if (strcmp(argv[i], "--memo") == 0)
+      lmemo.on = 1;
+    else if (strncmp(argv[i], "--memo=", 7) == 0 && atol(argv[i] + 7) > 0) {
+      lmemo.on = 1;
+      lmemo.cap = (size_t) atol(argv[i] + 7) * 1024;
+    }
+    else {
+      fprintf(stderr, "Usage: %s [--arena] [--stats] [--fold] [--dump] "
+              "[--memo[=KB]] "
+              "[--reader=mpc|direct]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (lmemo.cap == 0)
+    lmemo.cap = LMEMO_CAP;
+
+  lenv *e = lenv_new();
+  lenv_add_builtins(e);
+
+  /* Create parsers */
+  // TODO define JSON grammar
   mpc_parser_t *Number    = mpc_new("number");
   mpc_parser_t *Symbol    = mpc_new("symbol");
   mpc_parser_t *Sexpr     = mpc_new("sexpr");
@@ -555,19 +4443,20 @@ int main(int argc, char** argv)
   mpc_parser_t *Lezchty   = mpc_new("lezchty");
 
   /* Define language parser */
-  // FIXME Add floating point numbers support.
-  // FIXME Add missing and useful operators such as ^, %, min, max
+  // FIXME Add missing and useful operators such as ^, min, max
   // FIXME Change - operator so that when it receives one argument negates it
   mpca_lang(MPCA_LANG_DEFAULT,
     "                                                           \
-      number    :  /-?[0-9]+/ ;                                 \
-      symbol    : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;            \
+      number    :  /-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?/ ;   \
+      symbol    : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%]+/ ;           \
       sexpr    :  '(' <expr>* ')' ;                             \
       qexpr	: '{' <expr>* '}' ;				\
       expr      : <number> | <symbol> | <sexpr> | <qexpr> ;  \
       lezchty   : /^/ <expr>* /$/ ;                        \
     ",
     Number, Symbol, Sexpr, Qexpr, Expr, Lezchty);
+  lval_read_tags ();
+  mpc_arena_t *parse_arena = use_arena && use_mpc ? mpc_arena_new () : NULL;
 
 
   /* Print version and Exit information */
@@ -581,20 +4470,72 @@ int main(int argc, char** argv)
   while (1) {
     /* Output our prompt */
     char* input = readline("lez> ");
+    if (input == NULL)
+      break;
 
     /* Add input to history */
     add_history(input);
 
     /* Parse user input */
-    mpc_result_t r;
-    if (mpc_parse ("<stdin>", input, Lezchty, &r)) {
-      lval *x = lval_eval (lval_read (r.output));
-      lval_println (x);
-      lval_del (x);
-      mpc_ast_delete (r.output);
+    if (use_arena)
+      lalloc_arena_begin ();
+    lval *x = NULL;
+    if (use_mpc) {
+      mpc_result_t r;
+      if (use_arena)
+        mpc_arena_begin (parse_arena);
+      if (mpc_parse_slices ("<stdin>", input, Lezchty, &r)) {
+        x = lval_read (r.output);
+        mpc_ast_delete (r.output);
+      } else {
+        mpc_err_print (r.error);
+        mpc_err_delete (r.error);
+      }
+      /* Everything the parse allocated goes at once */
+      if (use_arena) {
+        if (show_stats) {
+          fflush (stdout);
+          fprintf (stderr, "; parse %ld allocs %ld bytes\n",
+                   mpc_arena_allocs (parse_arena),
+                   mpc_arena_bytes (parse_arena));
+        }
+        mpc_arena_end (parse_arena);
+      }
     } else {
-      mpc_err_print (r.error);
-      mpc_err_delete (r.error);
+      char *err;
+      x = lval_read_input ("<stdin>", input, &err);
+      if (x == NULL) {
+        fputs (err, stdout);
+        free (err);
+      }
+    }
+
+    if (x) {
+      if (lfold)
+        x = lval_fold (e, x);
+      /* Show the tree about to be evaluated */
+      if (dump) {
+        fputs ("; ", stdout);
+        lval_println (x);
+      }
+      clock_t start = clock ();
+      x = lval_eval (e, x);
+      double ms = (double) (clock () - start) * 1000 / CLOCKS_PER_SEC;
+      lval_println (x);
+      /* The arena drops the whole line at once */
+      if (use_arena)
+        lalloc_arena_end ();
+      else
+        lval_del (x);
+      if (show_stats) {
+        fflush (stdout);
+        fprintf (stderr, "; eval %.3f ms\n", ms);
+        lalloc_stats_print ();
+      }
+      if (show_stats && lmemo.on)
+        lmemo_stats_print ();
+    } else if (use_arena) {
+      lalloc_arena_end ();
     }
 
     /* Free retrieved input */
@@ -603,6 +4544,9 @@ int main(int argc, char** argv)
 
   /* Undefine and Delete Parsers */
   mpc_cleanup (6, Number, Symbol, Sexpr, Qexpr, Expr, Lezchty);
+  if (parse_arena)
+    mpc_arena_delete (parse_arena);
+  lenv_del (e);
 
   return 0;
 }
@@ -0,0 +1,124 @@
+#!/bin/sh
+# Checks bignum sums, products, quotients and remainders against python3.
+# The operands are sized in base 2^32 digits around LBIG_KARATSUBA (32),
+# where products switch to Karatsuba, and around the divisor lengths that
+# long division (Knuth D) normalizes and corrects its quotient digits at,
+# with digits picked from 0, 1, 2^31 and 2^32 - 1 as often as at random.
+# Quotients and remainders are truncated like C does.
+#
+#     sh tests/bignum_diff.sh [./parsing]
+#
+# CASES=... lines per group, SEED=... another set of operands.
+
+LEZ=${1:-./parsing}
+CASES=${CASES:-40}
+SEED=${SEED:-15}
+tmp=${TMPDIR:-/tmp}/lez_bignum.$$
+trap 'rm -f "$tmp".*' EXIT
+failed=0
+
+if ! command -v python3 > /dev/null 2>&1; then
+  echo "skip: python3 computes the expected values"
+  exit 0
+fi
+
+# Writes the expressions to $tmp.in, their values to $tmp.want and the
+# name of the group of each line to $tmp.group
+python3 - "$tmp" "$CASES" "$SEED" <<'EOF'
+import random, sys
+
+tmp, cases, seed = sys.argv[1], int(sys.argv[2]), int(sys.argv[3])
+rnd = random.Random(seed)
+KARATSUBA = 32
+
+def digit():
+    if rnd.random() < 0.5:
+        return rnd.choice([0, 1, 1 << 31, (1 << 32) - 1])
+    return rnd.getrandbits(32)
+
+# A number of n base 2^32 digits, the top one not zero
+def number(n):
+    x = 0
+    for _ in range(n - 1):
+        x = (x << 32) | digit()
+    top = digit() or 1
+    return (top << (32 * (n - 1))) | x
+
+def signed(x):
+    return -x if rnd.random() < 0.5 else x
+
+def trunc_div(a, b):
+    q = abs(a) // abs(b)
+    return -q if (a < 0) != (b < 0) else q
+
+lines = []
+
+def case(group, op, a, b):
+    if op == '+':
+        v = a + b
+    elif op == '-':
+        v = a - b
+    elif op == '*':
+        v = a * b
+    elif op == '/':
+        v = trunc_div(a, b)
+    else:
+        v = a - trunc_div(a, b) * b
+    lines.append((group, "(%s %d %d)" % (op, a, b), v))
+
+near = [KARATSUBA - 2, KARATSUBA - 1, KARATSUBA, KARATSUBA + 1,
+        2 * KARATSUBA - 1, 2 * KARATSUBA, 2 * KARATSUBA + 1]
+
+for _ in range(cases):
+    case("sums with carries", rnd.choice('+-'),
+         signed(number(rnd.randint(1, 40))), signed(number(rnd.randint(1, 40))))
+
+for _ in range(cases):
+    case("products around the Karatsuba cutoff", '*',
+         signed(number(rnd.choice(near))), signed(number(rnd.choice(near))))
+
+for _ in range(cases):
+    case("products of unequal lengths", '*',
+         signed(number(rnd.choice(near))), signed(number(rnd.randint(1, 12))))
+
+for _ in range(cases):
+    b = number(rnd.choice([1, 2, 3] + near))
+    a = number(rnd.choice([0, 1, 2, 31, 32, 33]) + (b.bit_length() + 31) // 32)
+    case("quotients and remainders", rnd.choice('/%'), signed(a), signed(b))
+
+# Dividends just off a multiple of the divisor, where a quotient digit
+# guessed from the top digits is most often one or two too big
+for _ in range(cases):
+    b = number(rnd.choice([2, 3] + near))
+    q = number(rnd.choice([1, 2, KARATSUBA, KARATSUBA + 1]))
+    a = q * b + rnd.choice([0, 1, -1, b - 1])
+    case("dividends near a multiple", rnd.choice('/%'), signed(a), signed(b))
+
+with open(tmp + ".in", "w") as f, open(tmp + ".want", "w") as w, \
+     open(tmp + ".group", "w") as g:
+    for group, line, v in lines:
+        f.write(line + "\n")
+        w.write("%d\n" % v)
+        g.write(group + "\n")
+EOF
+
+# The values are the lines after the banner that do not echo a prompt
+"$LEZ" < "$tmp.in" 2>&1 | tail -n +7 | grep -v '^lez> ' > "$tmp.got"
+
+# One line for each group, the first wrong value of each failing one
+paste -d '\t' "$tmp.group" "$tmp.want" "$tmp.got" "$tmp.in" | awk -F '\t' '
+  !($1 in seen) { seen[$1] = 1; order[n++] = $1 }
+  $2 != $3 && !($1 in bad) { bad[$1] = substr ($4, 1, 60) "..." }
+  END {
+    for (i = 0; i < n; i++)
+      if (order[i] in bad) { print "FAIL " order[i] ": " bad[order[i]]; failed = 1 }
+      else print "ok   " order[i]
+    exit failed
+  }' || failed=1
+
+if [ "$(wc -l < "$tmp.got")" -ne "$(wc -l < "$tmp.want")" ]; then
+  echo "FAIL got $(wc -l < "$tmp.got") values for $(wc -l < "$tmp.want") lines"
+  failed=1
+fi
+
+exit $failed
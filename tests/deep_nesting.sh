@@ -0,0 +1,50 @@
+#!/bin/sh
+# Feeds expressions nested a million deep to the direct reader and to the
+# mpc reader, and checks that each one prints the right value instead of
+# running out of C stack.
+#
+#     sh tests/deep_nesting.sh [./parsing]
+#
+# DEPTH=... picks another depth.
+
+LEZ=${1:-./parsing}
+DEPTH=${DEPTH:-1000000}
+tmp=${TMPDIR:-/tmp}/lez_deep.$$
+trap 'rm -f "$tmp".*' EXIT
+failed=0
+
+# pre repeated DEPTH times, then mid, then post repeated DEPTH times
+nest () {
+  awk -v d="$DEPTH" -v pre="$1" -v mid="$2" -v post="$3" 'BEGIN {
+    for (i = 0; i < d; i++) printf "%s", pre
+    printf "%s", mid
+    for (i = 0; i < d; i++) printf "%s", post
+    printf "\n"
+  }'
+}
+
+# name, input, expected value
+check () {
+  for mode in --reader=direct --reader=mpc; do
+    printf '%s\n' "$2" | "$LEZ" $mode > "$tmp.out" 2>&1
+    status=$?
+    # The value is the line before the last prompt
+    tail -n 2 "$tmp.out" | head -n 1 > "$tmp.got"
+    printf '%s\n' "$3" > "$tmp.want"
+    if [ $status -ne 0 ] || ! cmp -s "$tmp.got" "$tmp.want"; then
+      echo "FAIL $1 $mode (exit $status)"
+      failed=1
+    else
+      echo "ok   $1 $mode"
+    fi
+  done
+}
+
+check "nested calls" "$(nest '(+ 1 ' '0' ')')" "$DEPTH"
+check "nested lists" "$(nest '(list ' '1' ')')" "$(nest '{' '1' '}')"
+check "nested Q-Expressions" "$(nest '{' '' '}')" "$(nest '{' '' '}')"
+check "eval chain" "$(nest 'eval {' '+ 1 2' '}')" "3"
+check "nested evals" "$(nest '(eval {' '+ 1 2' '})')" "3"
+check "evals in calls" "$(nest '(+ 1 (eval {' '0' '}))')" "$DEPTH"
+
+exit $failed
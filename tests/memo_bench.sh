@@ -0,0 +1,59 @@
+#!/bin/sh
+# Times evaluation with and without --memo on lines that come back over
+# and over: products of big numbers, slow enough to remember, and small
+# sums, quicker to evaluate again than to look up. The times are the
+# "; eval" lines of --stats, so reading the input does not count. Fails
+# if --memo changes any value.
+#
+#     sh tests/memo_bench.sh [./parsing]
+#
+# LINES=... distinct lines, REPEAT=... times each.
+
+LEZ=${1:-./parsing}
+LINES=${LINES:-200}
+REPEAT=${REPEAT:-10}
+tmp=${TMPDIR:-/tmp}/lez_memo.$$
+trap 'rm -f "$tmp".*' EXIT
+failed=0
+
+# LINES lines of n numbers of digits digits under op, REPEAT times over
+lines () {
+  awk -v l="$LINES" -v r="$REPEAT" -v op="$1" -v n="$2" -v digits="$3" 'BEGIN {
+    srand (14)
+    for (i = 0; i < l; i++) {
+      line[i] = "(" op
+      for (j = 0; j < n; j++) {
+        x = " " (1 + int (rand () * 9))
+        for (k = 1; k < digits; k++) x = x int (rand () * 10)
+        line[i] = line[i] x
+      }
+      line[i] = line[i] ")"
+    }
+    for (k = 0; k < r; k++)
+      for (i = 0; i < l; i++) print line[(i * 7 + k) % l]
+  }'
+}
+
+# Milliseconds spent evaluating, by the --stats lines
+total () {
+  awk '$1 == ";" && $2 == "eval" { ms += $3 } END { printf "%.1f", ms }' "$1"
+}
+
+# name, input
+bench () {
+  printf '%s\n' "$2" > "$tmp.in"
+  "$LEZ" --stats < "$tmp.in" > "$tmp.plain" 2>&1
+  "$LEZ" --memo --stats < "$tmp.in" > "$tmp.memo" 2>&1
+  grep -v '^; ' "$tmp.plain" > "$tmp.plain.values"
+  grep -v '^; ' "$tmp.memo" > "$tmp.memo.values"
+  if ! cmp -s "$tmp.plain.values" "$tmp.memo.values"; then
+    echo "FAIL $1: --memo changed the values"
+    failed=1
+  fi
+  echo "$1: $(total "$tmp.plain") ms, with --memo $(total "$tmp.memo") ms"
+}
+
+bench "products of four 300 digit numbers" "$(lines '*' 4 300)"
+bench "sums of eight 2 digit numbers" "$(lines '+' 8 2)"
+
+exit $failed
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Feeds malformed lines to the direct reader and to --reader=mpc. Both must
+# stop at the same row and column. A number cut short after its '.' must
+# also be reported in the same words; elsewhere the direct reader names
+# "expression" where mpc lists every token that could start one.
+#
+#     sh tests/reader_errors.sh [./parsing]
+
+LEZ=${1:-./parsing}
+tmp=${TMPDIR:-/tmp}/lez_read.$$
+trap 'rm -f "$tmp".*' EXIT
+failed=0
+
+# The error is the line before the last prompt
+error () {
+  printf '%s\n' "$2" | "$LEZ" $1 2>&1 | tail -n 2 | head -n 1
+}
+
+# kind, input: kind is "same" when the whole message must match, "place"
+# when only the filename, row and column must
+check () {
+  direct=$(error "" "$2")
+  mpc=$(error --reader=mpc "$2")
+  if [ "$1" = place ]; then
+    direct=${direct%%: error*}
+    mpc=${mpc%%: error*}
+  fi
+  if [ "$direct" != "$mpc" ]; then
+    echo "FAIL $2"
+    echo "  direct: $direct"
+    echo "  mpc:    $mpc"
+    failed=1
+  else
+    echo "ok   $2"
+  fi
+}
+
+for t in '2.' '-2.' '1.e5' '3.e' '2..' '2.x' '2.)' '(+ 2. 3)' '{1 2.}' 'abc 2.'; do
+  check same "$t"
+done
+
+for t in '.5' '-.5' '.' ')' '(1' '1.5.3' 'a.b' '1 .5' '(. 1)' '{.}' '1e.5' \
+         '+ 1 .'; do
+  check place "$t"
+done
+
+exit $failed